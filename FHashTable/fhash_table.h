@@ -1,26 +1,467 @@
 #pragma once
 #include <stdint.h>
+#include <string.h>
 #include <assert.h>
 #include <memory>
 #include <vector>
 #include <limits>
 #include <cmath>
+#include <algorithm>
+#include <iterator>
+#include <chrono>
+#include <thread>
+#include <functional>
+#include <atomic>
+#include <random>
+#include <type_traits>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <xmmintrin.h>
+#include <intrin.h>
+#define FHASH_PREFETCH(address) _mm_prefetch((const char*)(address), _MM_HINT_T0)
+#else
+#define FHASH_PREFETCH(address) __builtin_prefetch(address)
+#endif
+
+// the positions of the lowest and the highest set bits, bits must not be 0.
+inline int32_t fhash_lowest_bit(uint64_t bits)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward64(&index, bits);
+	return int32_t(index);
+#else
+	return __builtin_ctzll(bits);
+#endif
+}
+
+inline int32_t fhash_highest_bit(uint64_t bits)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanReverse64(&index, bits);
+	return int32_t(index);
+#else
+	return 63 - __builtin_clzll(bits);
+#endif
+}
+
+enum class fhash_operation
+{
+	find,
+	insert,
+	free_tree_walk,
+	count,
+};
+
+// statistics hooks called from the hot paths, all empty so they compile to nothing.
+struct fhash_no_stats
+{
+	void on_operation_begin(fhash_operation) {}
+	void on_operation_end(fhash_operation) {}
+	void on_touch(const void*, size_t) {}
+	void on_insert() {}
+	void on_insert_victim() {}
+	void on_find_hit(size_t) {}
+	void on_find_miss(size_t) {}
+	void on_remove() {}
+	void on_free_tree_search(size_t) {}
+	void on_rehash_begin() {}
+	void on_rehash_end() {}
+	void on_allocate(size_t) {}
+	void on_free(size_t) {}
+};
+
+// counts the hot path operations, use it as allocator_policy::stats_t to enable.
+struct fhash_runtime_stats : fhash_no_stats
+{
+	uint64_t inserts = 0;
+	uint64_t victims_displaced = 0;
+	uint64_t removes = 0;
+	uint64_t find_hits = 0;
+	uint64_t find_hit_chain_length = 0;
+	uint64_t find_misses = 0;
+	uint64_t find_miss_chain_length = 0;
+	uint64_t max_chain_length = 0;
+	uint64_t free_tree_searches = 0;
+	uint64_t free_tree_depth = 0;
+	uint64_t max_free_tree_depth = 0;
+	uint64_t rehash_count = 0;
+	uint64_t rehash_nanoseconds = 0;
+	uint64_t bytes_allocated = 0;
+	uint64_t bytes_freed = 0;
+
+	void on_insert() { inserts++; }
+	void on_insert_victim() { victims_displaced++; }
+
+	void on_find_hit(size_t chain_length)
+	{
+		find_hits++;
+		find_hit_chain_length += chain_length;
+		max_chain_length = std::max<uint64_t>(max_chain_length, chain_length);
+	}
+
+	void on_find_miss(size_t chain_length)
+	{
+		find_misses++;
+		find_miss_chain_length += chain_length;
+		max_chain_length = std::max<uint64_t>(max_chain_length, chain_length);
+	}
+
+	void on_remove() { removes++; }
+
+	void on_free_tree_search(size_t depth)
+	{
+		free_tree_searches++;
+		free_tree_depth += depth;
+		max_free_tree_depth = std::max<uint64_t>(max_free_tree_depth, depth);
+	}
+
+	void on_rehash_begin()
+	{
+		rehash_start = std::chrono::steady_clock::now();
+	}
+
+	void on_rehash_end()
+	{
+		rehash_count++;
+		rehash_nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - rehash_start).count();
+	}
+
+	void on_allocate(size_t bytes) { bytes_allocated += bytes; }
+	void on_free(size_t bytes) { bytes_freed += bytes; }
+
+private:
+	std::chrono::steady_clock::time_point rehash_start;
+};
+
+// debug tracer, records the distinct cache lines every operation touches.
+// histograms[op][n] is the number of operations that touched n distinct cache lines.
+struct fhash_cache_line_tracer : fhash_no_stats
+{
+	static constexpr size_t cache_line_size = 64;
+	static constexpr size_t operation_count = size_t(fhash_operation::count);
+
+	std::vector<uint64_t> histograms[operation_count];
+
+	void on_operation_begin(fhash_operation op)
+	{
+		// nested operations of the same kind (e.g. victim reinsertion) are counted as one.
+		if (depths[size_t(op)]++ == 0)
+		{
+			lines[size_t(op)].clear();
+		}
+	}
+
+	void on_operation_end(fhash_operation op)
+	{
+		if (--depths[size_t(op)] == 0)
+		{
+			std::vector<uint64_t>& histogram = histograms[size_t(op)];
+			const size_t n = lines[size_t(op)].size();
+			if (histogram.size() <= n)
+			{
+				histogram.resize(n + 1);
+			}
+			histogram[n]++;
+		}
+	}
+
+	void on_touch(const void* address, size_t size)
+	{
+		const uintptr_t first = uintptr_t(address) / cache_line_size;
+		const uintptr_t last = (uintptr_t(address) + size - 1) / cache_line_size;
+		for (size_t op = 0; op < operation_count; op++)
+		{
+			if (depths[op] == 0)
+			{
+				continue;
+			}
+			for (uintptr_t line = first; line <= last; line++)
+			{
+				std::vector<uintptr_t>& op_lines = lines[op];
+				if (std::find(op_lines.begin(), op_lines.end(), line) == op_lines.end())
+				{
+					op_lines.push_back(line);
+				}
+			}
+		}
+	}
+
+	double average_cache_lines(fhash_operation op) const
+	{
+		const std::vector<uint64_t>& histogram = histograms[size_t(op)];
+		uint64_t count = 0;
+		uint64_t sum = 0;
+		for (size_t i = 0; i < histogram.size(); i++)
+		{
+			count += histogram[i];
+			sum += histogram[i] * i;
+		}
+		return count > 0 ? double(sum) / count : 0.0;
+	}
+
+	double average_bytes(fhash_operation op) const
+	{
+		return average_cache_lines(op) * cache_line_size;
+	}
+
+private:
+	size_t depths[operation_count] = {};
+	std::vector<uintptr_t> lines[operation_count];
+};
+
+// the default storage of the entries.
+struct fhash_malloc_memory
+{
+	static void* allocate(size_t bytes)
+	{
+		return malloc(bytes);
+	}
+
+	static void deallocate(void* p, size_t)
+	{
+		free(p);
+	}
+};
+
+// maps the entries with 2MB pages, so finds in tables far larger than L3 don't miss the TLB as well.
+// tries MAP_HUGETLB first, then transparent huge pages with madvise, then a plain mapping. allocations smaller
+// than a huge page and other platforms use malloc. set prefault to fault in all the pages on allocation, i.e. during rehash.
+template <bool prefault = false>
+struct fhash_huge_page_memory
+{
+	static constexpr size_t huge_page_size = 2 * 1024 * 1024;
+
+	static void* allocate(size_t bytes)
+	{
+#if defined(__linux__)
+		if (bytes >= huge_page_size)
+		{
+			const size_t mapped_bytes = get_mapped_bytes(bytes);
+			const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+			void* p = mmap(nullptr, mapped_bytes, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB | (prefault ? MAP_POPULATE : 0), -1, 0);
+			if (p != MAP_FAILED)
+			{
+				return p;
+			}
+			// transparent huge pages need 2MB aligned addresses, map one more huge page and trim.
+			char* address = nullptr;
+			char* raw = (char*)mmap(nullptr, mapped_bytes + huge_page_size, PROT_READ | PROT_WRITE, flags, -1, 0);
+			if (raw != MAP_FAILED)
+			{
+				address = (char*)(((uintptr_t)raw + huge_page_size - 1) & ~(uintptr_t)(huge_page_size - 1));
+				if (address != raw)
+				{
+					munmap(raw, address - raw);
+				}
+				munmap(address + mapped_bytes, raw + huge_page_size - address);
+			}
+			else
+			{
+				// no room for the extra huge page, map without aligning. every path maps exactly mapped_bytes,
+				// so deallocate unmaps by the size alone.
+				address = (char*)mmap(nullptr, mapped_bytes, PROT_READ | PROT_WRITE, flags, -1, 0);
+				if (address == (char*)MAP_FAILED)
+				{
+					return nullptr;
+				}
+			}
+#if defined(MADV_HUGEPAGE)
+			madvise(address, mapped_bytes, MADV_HUGEPAGE);
+#endif
+			if (prefault)
+			{
+				for (size_t offset = 0; offset < mapped_bytes; offset += 4096)
+				{
+					address[offset] = 0;
+				}
+			}
+			return address;
+		}
+#endif
+		return malloc(bytes);
+	}
+
+	static void deallocate(void* p, size_t bytes)
+	{
+#if defined(__linux__)
+		if (bytes >= huge_page_size)
+		{
+			munmap(p, get_mapped_bytes(bytes));
+			return;
+		}
+#endif
+		free(p);
+	}
+
+private:
+	static size_t get_mapped_bytes(size_t bytes)
+	{
+		return (bytes + huge_page_size - 1) & ~(huge_page_size - 1);
+	}
+};
+
+// the hasher output, tagged with the hasher type so it can only be passed to the tables sharing the hasher.
+template <typename hasher_t>
+struct fhash_precomputed_hash
+{
+	size_t value;
+};
 
 struct fhash_default_allocator_policy
 {
+	// the defaults of fhash_table::set_load_parameters, average_number_of_elements_per_bucket100 must be at least 100.
 	static constexpr int32_t average_number_of_elements_per_bucket100 = 150;
+	static constexpr int32_t growth_factor100 = 200;
 	static constexpr int32_t min_number_of_hash_buckets = 2;
 	static constexpr int32_t min_number_of_entries = 4;
 	using fhash_size_t = int32_t;
 	// consider using int64_t if the table size may be larger than 2^30, with the cost of performance.
 	// using fhash_size_t = int64_t;
+	// use fhash_runtime_stats to count the hot path operations, stats are not moved or copied with the table.
+	// the const operations such as find update the stats too, so a table with a non empty stats_t must not be
+	// read from several threads at once. fhash_no_stats keeps the const operations safe to call concurrently.
+	// use fhash_cache_line_tracer to measure the memory touched by each operation, debug only.
+	using stats_t = fhash_no_stats;
+	// set to a power of 2 to split the entries into pages of that many entries, copies of the table then share
+	// the pages and a page is copied before its first write, so copying is O(pages), see fhash_table::snapshot.
+	static constexpr int32_t cow_page_entries = 0;
+	// allocates the entries, use fhash_huge_page_memory for tables far larger than L3. pages of cow_page_entries use malloc.
+	using memory_t = fhash_malloc_memory;
+	// prefer the free slots in the cache line of the chain head, then in its page, then the nearest one,
+	// so more chains are found with a single cache miss.
+	static constexpr bool cache_line_aware_allocation = false;
+	// hash every key to two buckets and insert it into the shorter chain, find looks up both chains.
+	// the longest chain drops from O(log n / log log n) to O(log log n), at the cost of a second lookup on misses.
+	static constexpr bool two_choice = false;
+	// keep one byte per bucket with a bit of the hash of every key in the chain, a find whose bit is clear misses
+	// without touching the entries. the bits of erased keys stay until the chain is empty or the table rehashes.
+	// every copy of the table, snapshots included, copies the whole filter.
+	static constexpr bool bucket_filter = false;
+	// when not 0, every self_organizing_period-th hit of a non-head element by find on a non-const table swaps it
+	// with its predecessor, so hot keys drift to the chain heads under skewed access. the period bounds the writes
+	// of read mostly tables. such a find moves other elements, the pointers of earlier finds may be invalidated.
+	static constexpr int32_t self_organizing_period = 0;
+	// when not 0, an insert building a chain longer than max_chain_length rehashes the table with a random seed mixed
+	// into the hash, at most once per doubling of the size. guards externally keyed tables against hash flooding,
+	// keys with equal hashes still share a chain.
+	static constexpr int32_t max_chain_length = 0;
+	// map the hashes to any number of buckets by a multiply-high range reduction instead of masking a power of 2,
+	// so the buckets follow the expected size and growth_factor100 below 200 grows in finer steps.
+	// costs a multiplication per slot computation, the buckets are at most 2^32.
+	static constexpr bool fastrange_buckets = false;
 };
 
-template <typename key_t, typename value_t, typename hasher_t = std::hash<key_t>, typename allocator_policy = fhash_default_allocator_policy>
-class fhash_table
+template <typename...>
+struct fhash_make_void
+{
+	using type = void;
+};
+
+// detects the members of an allocator policy, the missing ones are taken from fhash_default_allocator_policy.
+struct fhash_policy_members
+{
+#define FHASH_POLICY_VALUE(name) \
+	template <typename policy_t, typename = void> \
+	struct name##_of : std::integral_constant<std::remove_const_t<decltype(fhash_default_allocator_policy::name)>, \
+		fhash_default_allocator_policy::name> {}; \
+	template <typename policy_t> \
+	struct name##_of<policy_t, typename fhash_make_void<decltype(policy_t::name)>::type> \
+		: std::integral_constant<std::remove_const_t<decltype(fhash_default_allocator_policy::name)>, policy_t::name> {};
+
+#define FHASH_POLICY_TYPE(name) \
+	template <typename policy_t, typename = void> \
+	struct name##_of { using type = fhash_default_allocator_policy::name; }; \
+	template <typename policy_t> \
+	struct name##_of<policy_t, typename fhash_make_void<typename policy_t::name>::type> { using type = typename policy_t::name; };
+
+	FHASH_POLICY_VALUE(average_number_of_elements_per_bucket100)
+	FHASH_POLICY_VALUE(growth_factor100)
+	FHASH_POLICY_VALUE(min_number_of_hash_buckets)
+	FHASH_POLICY_VALUE(min_number_of_entries)
+	FHASH_POLICY_TYPE(fhash_size_t)
+	FHASH_POLICY_TYPE(stats_t)
+	FHASH_POLICY_VALUE(cow_page_entries)
+	FHASH_POLICY_TYPE(memory_t)
+	FHASH_POLICY_VALUE(cache_line_aware_allocation)
+	FHASH_POLICY_VALUE(two_choice)
+	FHASH_POLICY_VALUE(bucket_filter)
+	FHASH_POLICY_VALUE(self_organizing_period)
+	FHASH_POLICY_VALUE(max_chain_length)
+	FHASH_POLICY_VALUE(fastrange_buckets)
+
+#undef FHASH_POLICY_VALUE
+#undef FHASH_POLICY_TYPE
+};
+
+// an allocator policy with every member of fhash_default_allocator_policy, so a policy needn't derive from it.
+template <typename allocator_policy>
+struct fhash_policy_traits
+{
+	using members = fhash_policy_members;
+	static constexpr int32_t average_number_of_elements_per_bucket100 =
+		members::average_number_of_elements_per_bucket100_of<allocator_policy>::value;
+	static constexpr int32_t growth_factor100 = members::growth_factor100_of<allocator_policy>::value;
+	static constexpr int32_t min_number_of_hash_buckets = members::min_number_of_hash_buckets_of<allocator_policy>::value;
+	static constexpr int32_t min_number_of_entries = members::min_number_of_entries_of<allocator_policy>::value;
+	using fhash_size_t = typename members::fhash_size_t_of<allocator_policy>::type;
+	using stats_t = typename members::stats_t_of<allocator_policy>::type;
+	static constexpr int32_t cow_page_entries = members::cow_page_entries_of<allocator_policy>::value;
+	using memory_t = typename members::memory_t_of<allocator_policy>::type;
+	static constexpr bool cache_line_aware_allocation = members::cache_line_aware_allocation_of<allocator_policy>::value;
+	static constexpr bool two_choice = members::two_choice_of<allocator_policy>::value;
+	static constexpr bool bucket_filter = members::bucket_filter_of<allocator_policy>::value;
+	static constexpr int32_t self_organizing_period = members::self_organizing_period_of<allocator_policy>::value;
+	static constexpr int32_t max_chain_length = members::max_chain_length_of<allocator_policy>::value;
+	static constexpr bool fastrange_buckets = members::fastrange_buckets_of<allocator_policy>::value;
+};
+
+// keeps allocator_policy::stats_t as a mutable member, the stats are updated by the const operations too.
+template <typename stats_t, bool = std::is_empty<stats_t>::value>
+class fhash_stats_holder
+{
+protected:
+	stats_t& stats() const
+	{
+		return m_stats;
+	}
+
+private:
+	mutable stats_t m_stats;
+};
+
+// an empty stats_t such as fhash_no_stats has no state to update, all the tables share one and it takes no space.
+template <typename stats_t>
+class fhash_stats_holder<stats_t, true>
+{
+protected:
+	stats_t& stats() const
+	{
+		return s_stats;
+	}
+
+private:
+	static stats_t s_stats;
+};
+
+template <typename stats_t>
+stats_t fhash_stats_holder<stats_t, true>::s_stats;
+
+template <typename key_t, typename value_t, typename hasher_t = std::hash<key_t>, typename user_allocator_policy = fhash_default_allocator_policy>
+class fhash_table : private fhash_stats_holder<typename fhash_policy_traits<user_allocator_policy>::stats_t>
 {
 public:
+	// the members missing from user_allocator_policy are the ones of fhash_default_allocator_policy.
+	using allocator_policy = fhash_policy_traits<user_allocator_policy>;
 	using fhash_size_t = typename allocator_policy::fhash_size_t;
+	using stats_t = typename allocator_policy::stats_t;
+	using memory_t = typename allocator_policy::memory_t;
+	using precomputed_hash_t = fhash_precomputed_hash<hasher_t>;
 	template <typename raw_integer_t, typename tag>
 	struct integer_t
 	{
@@ -52,9 +493,32 @@ public:
 	using node_index_t = integer_t<fhash_size_t, tag_node_index>;
 	using hash_t = integer_t<fhash_size_t, tag_hash>;
 
+	// such data can be copied with memcpy and needn't be destructed.
+	static constexpr bool is_trivially_copyable_data = std::is_trivially_copyable<key_t>::value && std::is_trivially_copyable<value_t>::value;
+	static constexpr bool is_trivially_destructible_data = std::is_trivially_destructible<key_t>::value && std::is_trivially_destructible<value_t>::value;
+
 	static constexpr index_t invalid_index = index_t(-1);
 	static constexpr node_index_t invalid_node_index = node_index_t(-2);
 
+	static constexpr bool is_paged = allocator_policy::cow_page_entries > 0;
+	static constexpr fhash_size_t page_entries = is_paged ? allocator_policy::cow_page_entries : 1;
+	static_assert((page_entries & (page_entries - 1)) == 0, "allocator_policy::cow_page_entries must be a power of 2");
+	static_assert(!is_paged || allocator_policy::cow_page_entries >= allocator_policy::min_number_of_entries,
+		"allocator_policy::cow_page_entries >= allocator_policy::min_number_of_entries");
+	using paged_t = std::integral_constant<bool, is_paged>;
+	using cache_line_aware_t = std::integral_constant<bool, allocator_policy::cache_line_aware_allocation>;
+	using two_choice_t = std::integral_constant<bool, allocator_policy::two_choice>;
+	using chain_guard_t = std::integral_constant<bool, (allocator_policy::max_chain_length > 0)>;
+	using fastrange_t = std::integral_constant<bool, allocator_policy::fastrange_buckets>;
+	static constexpr uintptr_t cache_line_size = 64;
+	static constexpr uintptr_t memory_page_size = 4096;
+	// the number of keys upsert_batch keeps in flight.
+	static constexpr fhash_size_t upsert_batch_size = 16;
+
+	struct copy_by_insert {};
+	struct copy_by_memcpy {};
+	struct copy_by_sharing {};
+
 	static_assert(allocator_policy::min_number_of_entries >= allocator_policy::min_number_of_hash_buckets, 
 		"allocator_policy::min_number_of_entries >= allocator_policy::min_number_of_hash_buckets");
 
@@ -85,6 +549,24 @@ public:
 		return node_index_t(-3 - index.value);
 	}
 
+	struct operation_scope
+	{
+		operation_scope(stats_t& stats, fhash_operation op)
+			: m_stats(stats)
+			, m_op(op)
+		{
+			m_stats.on_operation_begin(m_op);
+		}
+
+		~operation_scope()
+		{
+			m_stats.on_operation_end(m_op);
+		}
+
+		stats_t& m_stats;
+		const fhash_operation m_op;
+	};
+
 	struct data
 	{
 		data() {}
@@ -96,8 +578,8 @@ public:
 
 		void construct(key_t k, value_t v)
 		{
-			new (&key) key_t(k);
-			new (&value) value_t(v);
+			new (&key) key_t(std::move(k));
+			new (&value) value_t(std::move(v));
 		}
 
 		void destruct()
@@ -150,6 +632,9 @@ public:
 		}
 	};
 
+	struct no_pages {};
+	using pages_t = typename std::conditional<is_paged, entry**, no_pages>::type;
+
 	template <bool bConst>
 	struct base_iterator
 	{
@@ -195,13 +680,16 @@ public:
 
 		void skip_empty()
 		{
-			for (; *this && !m_table->get_entry(m_index).is_data(); m_index++);
+			for (; *this && !m_table->read_entry(m_index).is_data(); m_index++);
 		}
 
 		it_key_t& key() const { return m_table->get_entry(m_index).d.get_key(); }
 
 		it_value_t& value() const { return m_table->get_entry(m_index).d.get_value(); }
 
+		// the position in [0, capacity()), see iterator_at.
+		fhash_size_t index() const { return m_index.value; }
+
 		std::pair<const key_t&, it_value_t&> operator* () const { return std::pair<const key_t&, it_value_t&>(key(), value()); }
 
 		/** conversion to "bool" returning true if the iterator is valid. */
@@ -241,6 +729,66 @@ public:
 		const_iterator& operator=(const const_iterator&) = default;
 	};
 
+	// owns an element extracted from the table, see extract and insert(node_type&&).
+	class node_type
+	{
+	public:
+		node_type() = default;
+
+		node_type(node_type&& other)
+		{
+			*this = std::move(other);
+		}
+
+		node_type& operator = (node_type&& other)
+		{
+			if (this != &other)
+			{
+				reset();
+				if (!other.empty())
+				{
+					construct(std::move(other.key()), std::move(other.mapped()));
+					other.reset();
+				}
+			}
+			return *this;
+		}
+
+		~node_type()
+		{
+			reset();
+		}
+
+		bool empty() const { return !m_has_data; }
+
+		explicit operator bool() const { return m_has_data; }
+
+		key_t& key() { return m_data.get_key(); }
+
+		value_t& mapped() { return m_data.get_value(); }
+
+	private:
+		friend class fhash_table;
+
+		void construct(key_t key, value_t value)
+		{
+			m_data.construct(std::move(key), std::move(value));
+			m_has_data = true;
+		}
+
+		void reset()
+		{
+			if (m_has_data)
+			{
+				m_data.destruct();
+				m_has_data = false;
+			}
+		}
+
+		data m_data;
+		bool m_has_data = false;
+	};
+
 	iterator      begin() { return make_iterator(0); }
 
 	const_iterator begin() const { return make_const_iterator(0); }
@@ -250,8 +798,74 @@ public:
 
 	const_iterator end() const { return make_const_iterator(capacity()); }
 
+	// iterates a contiguous part of the table.
+	template <typename it_t>
+	struct range
+	{
+		it_t first;
+		it_t last;
+		it_t begin() const { return first; }
+		it_t end() const { return last; }
+	};
+
+	// split [0, capacity()) into count contiguous ranges, which can be iterated concurrently.
+	std::vector<range<iterator>> partition(fhash_size_t count)
+	{
+		std::vector<range<iterator>> ranges;
+		for (fhash_size_t i = 0; i < count; i++)
+		{
+			ranges.push_back(range<iterator>{ make_iterator(partition_bound(i, count)), make_iterator(partition_bound(i + 1, count)) });
+		}
+		return ranges;
+	}
+
+	std::vector<range<const_iterator>> partition(fhash_size_t count) const
+	{
+		std::vector<range<const_iterator>> ranges;
+		for (fhash_size_t i = 0; i < count; i++)
+		{
+			ranges.push_back(range<const_iterator>{ make_const_iterator(partition_bound(i, count)), make_const_iterator(partition_bound(i + 1, count)) });
+		}
+		return ranges;
+	}
+
+	// calls fn(const key_t&, value_t&) for every element from thread_count threads, 0 for all the hardware threads.
+	// fn may modify the values but mustn't insert or erase.
+	template <typename function_t>
+	void parallel_for_each(function_t fn, fhash_size_t thread_count = 0)
+	{
+		if (thread_count <= 0)
+		{
+			thread_count = std::max(fhash_size_t(std::thread::hardware_concurrency()), fhash_size_t(1));
+		}
+		// the threads mustn't copy the shared pages concurrently.
+		unshare_pages(paged_t());
+		std::vector<range<iterator>> ranges = partition(thread_count);
+		auto for_each_range = [&fn](const range<iterator>& r) {
+			for (auto&& pr : r)
+			{
+				fn(pr.first, pr.second);
+			}
+		};
+		std::vector<std::thread> threads;
+		for (size_t i = 1; i < ranges.size(); i++)
+		{
+			threads.emplace_back(for_each_range, std::cref(ranges[i]));
+		}
+		for_each_range(ranges[0]);
+		for (std::thread& t : threads)
+		{
+			t.join();
+		}
+	}
+
 	fhash_table() = default;
 
+	explicit fhash_table(const hasher_t& hasher)
+		: m_hasher(hasher)
+	{
+	}
+
 	fhash_table(fhash_table&& other)
 	{
 		move_table(std::move(other));
@@ -271,6 +885,17 @@ public:
 
 	fhash_table& operator = (const fhash_table& other)
 	{
+		if (this == &other)
+		{
+			return *this;
+		}
+		if (!is_paged && is_trivially_copyable_data && m_entries != get_default_entries()
+			&& other.m_entries != get_default_entries() && m_entries_size == other.m_entries_size)
+		{
+			// both allocated with the same layout, reuse the memory.
+			copy_entries(other);
+			return *this;
+		}
 		clear();
 		copy_table(other);
 		return *this;
@@ -283,15 +908,26 @@ public:
 
 	void move_table(fhash_table&& other)
 	{
+		m_hasher = other.m_hasher;
+		m_seed = other.m_seed;
+		m_reseed_size = other.m_reseed_size;
+		m_elements_per_bucket100 = other.m_elements_per_bucket100;
+		m_growth_factor100 = other.m_growth_factor100;
 		m_entries = other.m_entries;
 		other.m_entries = get_default_entries();
 
+		m_pages = other.m_pages;
+		other.m_pages = get_default_pages(paged_t());
+
 		m_entries_size = other.m_entries_size;
 		other.m_entries_size = allocator_policy::min_number_of_entries;
 
 		m_bucket_size_minus_one = other.m_bucket_size_minus_one;
 		other.m_bucket_size_minus_one = allocator_policy::min_number_of_hash_buckets - 1;
 
+		m_bucket_filter = other.m_bucket_filter;
+		other.m_bucket_filter = get_default_bucket_filter();
+
 		m_size = other.m_size;
 		other.m_size = 0;
 
@@ -304,94 +940,464 @@ public:
 
 	void copy_table(const fhash_table& other)
 	{
-		reserve(other.size());
+		m_hasher = other.m_hasher;
+		m_seed = other.m_seed;
+		m_reseed_size = other.m_reseed_size;
+		m_elements_per_bucket100 = other.m_elements_per_bucket100;
+		m_growth_factor100 = other.m_growth_factor100;
+		using copy_tag = typename std::conditional<is_paged, copy_by_sharing,
+			typename std::conditional<is_trivially_copyable_data, copy_by_memcpy, copy_by_insert>::type>::type;
+		copy_table(other, copy_tag());
+	}
 
-		// now insert old data to new table.
+	// share the pages, they are copied before the first write.
+	void copy_table(const fhash_table& other, copy_by_sharing)
+	{
 		if (other.m_entries != get_default_entries())
 		{
-			const fhash_size_t cap = other.capacity();
-			for (fhash_size_t i = 0; i < cap; i++)
-			{
-				const entry& e = other.get_entry(index_t(i));
-				if (e.is_data() && e.d.prev == invalid_index)
-				{
-					insert_index_no_check(compute_hash_slot(e.d.get_key()), e.d.get_key(), e.d.get_value());
-				}
-			}
-
-			for (fhash_size_t i = 0; i < cap; i++)
+			const fhash_size_t page_count = get_page_count(other.m_entries_size);
+			m_pages = (entry**)malloc(page_count * sizeof(entry*));
+			this->stats().on_allocate(page_count * sizeof(entry*));
+			for (fhash_size_t i = 0; i < page_count; i++)
 			{
-				const entry& e = other.get_entry(index_t(i));
-				if (e.is_data() && e.d.prev != invalid_index)
-				{
-					insert_index_no_check(compute_hash_slot(e.d.get_key()), e.d.get_key(), e.d.get_value());
-				}
+				m_pages[i] = other.m_pages[i];
+				get_page_refs(m_pages[i]).fetch_add(1, std::memory_order_relaxed);
 			}
+			m_entries = other.m_entries;
+			m_entries_size = other.m_entries_size;
+			// the filter is written by every insert, sharing it would put a check on that path, copy it instead.
+			copy_bucket_filter(other);
+			m_bucket_size_minus_one = other.m_bucket_size_minus_one;
+			m_size = other.m_size;
+			m_root = other.m_root;
+			m_max_index = other.m_max_index;
 		}
 	}
 
-	void clear()
+	// bitwise copy of the whole layout, including chains and the free tree.
+	void copy_table(const fhash_table& other, copy_by_memcpy)
 	{
-		if (m_entries != get_default_entries())
+		if (other.m_entries != get_default_entries())
 		{
-			for (fhash_size_t i = 0; i < m_entries_size; i++)
-			{
-				entry& e = m_entries[i];
-				if (e.is_data())
-				{
-					e.d.destruct();
-				}
-			}
-			free(m_entries);
-			m_entries = get_default_entries();
+			m_entries = (entry*)memory_t::allocate(other.m_entries_size * sizeof(entry));
+			this->stats().on_allocate(other.m_entries_size * sizeof(entry));
+			copy_entries(other);
 		}
-		m_entries_size = allocator_policy::min_number_of_entries;
-		m_bucket_size_minus_one = allocator_policy::min_number_of_hash_buckets - 1;
-		m_size = 0;
-		m_root = invalid_index;
-		m_max_index = invalid_index;
 	}
 
-	const value_t* find(key_t key) const
+	void copy_entries(const fhash_table& other)
 	{
-		return find_index(key, compute_hash_slot(key),
-			[this](index_t index) {return &get_entry(index).d.get_value(); },
-			[this]() {return (const value_t*)nullptr; }
-			);
+		memcpy((void*)m_entries, other.m_entries, other.m_entries_size * sizeof(entry));
+		m_hasher = other.m_hasher;
+		m_seed = other.m_seed;
+		m_reseed_size = other.m_reseed_size;
+		m_elements_per_bucket100 = other.m_elements_per_bucket100;
+		m_growth_factor100 = other.m_growth_factor100;
+		m_entries_size = other.m_entries_size;
+		copy_bucket_filter(other);
+		m_bucket_size_minus_one = other.m_bucket_size_minus_one;
+		m_size = other.m_size;
+		m_root = other.m_root;
+		m_max_index = other.m_max_index;
 	}
 
-	value_t* find(key_t key)
+	void copy_table(const fhash_table& other, copy_by_insert)
 	{
-		return find_index(key, compute_hash_slot(key),
-			[this](index_t index) {return &get_entry(index).d.get_value(); },
-			[]() {return (value_t*)nullptr; }
+		reserve(other.size());
+
+		// now insert old data to new table.
+		if (other.m_entries != get_default_entries())
+		{
+			insert_entries(other);
+		}
+	}
+
+	// copy of the table sharing the pages when allocator_policy::cow_page_entries is set, otherwise a full copy.
+	// the snapshot can be read by another thread while this table is modified. with allocator_policy::bucket_filter
+	// the filter is still copied eagerly, so the snapshot costs O(buckets) time and bytes on top of O(pages).
+	fhash_table snapshot() const
+	{
+		return *this;
+	}
+
+	void clear()
+	{
+		if (m_entries != get_default_entries())
+		{
+			free_entries(paged_t());
+			m_entries = get_default_entries();
+			m_pages = get_default_pages(paged_t());
+		}
+		free_bucket_filter();
+		m_entries_size = allocator_policy::min_number_of_entries;
+		m_bucket_size_minus_one = allocator_policy::min_number_of_hash_buckets - 1;
+		m_size = 0;
+		m_root = invalid_index;
+		m_max_index = invalid_index;
+	}
+
+	const stats_t& get_stats() const
+	{
+		return this->stats();
+	}
+
+	void reset_stats()
+	{
+		this->stats() = stats_t();
+	}
+
+	hasher_t& hash_function()
+	{
+		return m_hasher;
+	}
+
+	const hasher_t& hash_function() const
+	{
+		return m_hasher;
+	}
+
+	// the hash can be reused by find, insert, erase and prefetch of all the tables with the same hasher_t.
+	precomputed_hash_t hash_of(const key_t& key) const
+	{
+		return precomputed_hash_t{ m_hasher(key) };
+	}
+
+	// prefetch the home slots, so looking up many tables can be pipelined.
+	void prefetch(precomputed_hash_t precomputed_hash) const
+	{
+		const hash_t hash = compute_hash(precomputed_hash);
+		FHASH_PREFETCH(&entry_at(compute_slot(hash), paged_t()));
+		if (allocator_policy::two_choice)
+		{
+			FHASH_PREFETCH(&entry_at(compute_second_slot(hash), paged_t()));
+		}
+	}
+
+	const value_t* find(key_t key) const
+	{
+		return find(key, hash_of(key));
+	}
+
+	value_t* find(key_t key)
+	{
+		return find(key, hash_of(key));
+	}
+
+	const value_t* find(key_t key, precomputed_hash_t precomputed_hash) const
+	{
+		return find_hash_index(key, compute_hash(precomputed_hash),
+			[this](index_t index) {return &get_entry(index).d.get_value(); },
+			[this]() {return (const value_t*)nullptr; }
+			);
+	}
+
+	// a hit copies its page if it is shared, the value can be written through the pointer.
+	value_t* find(key_t key, precomputed_hash_t precomputed_hash)
+	{
+		return find_hash_index(key, compute_hash(precomputed_hash),
+			[this](index_t index) {return &get_entry(move_toward_head(index)).d.get_value(); },
+			[]() {return (value_t*)nullptr; }
 		);
 	}
 
+	// finds the element in the chain of the hash satisfying pred(key, value), for keys that can be compared
+	// without constructing a key_t. returns end() if not found.
+	template <typename predicate_t>
+	const_iterator find_if(precomputed_hash_t precomputed_hash, predicate_t pred) const
+	{
+		return find_hash_index_if(compute_hash(precomputed_hash),
+			[&pred](const data& d) {return pred(d.get_key(), d.get_value()); },
+			[this](index_t index) {return make_const_iterator(index); },
+			[this]() {return end(); });
+	}
+
+	template <typename predicate_t>
+	iterator find_if(precomputed_hash_t precomputed_hash, predicate_t pred)
+	{
+		return find_hash_index_if(compute_hash(precomputed_hash),
+			[&pred](const data& d) {return pred(d.get_key(), d.get_value()); },
+			[this](index_t index) {return make_iterator(index); },
+			[this]() {return end(); });
+	}
+
 	iterator insert(key_t key, value_t value)
 	{
-		const hash_t hash = compute_hash(key);
-		const index_t index = find_index(key, compute_slot(hash), 
+		const precomputed_hash_t precomputed_hash = hash_of(key);
+		return insert(std::move(key), std::move(value), precomputed_hash);
+	}
+
+	iterator insert(key_t key, value_t value, precomputed_hash_t precomputed_hash)
+	{
+		const hash_t hash = compute_hash(precomputed_hash);
+		const index_t index = find_hash_index(key, hash, 
 			[](index_t index) {return index; },
 			[]() {return invalid_index; });
 		if (index != invalid_index)
 		{
 			// alread exists, replace it.
-			get_entry(index).d.get_value() = value;
+			get_entry(index).d.get_value() = std::move(value);
 			return make_iterator(index);
 		}
 	
-		reserve(m_size + 1);
-		return make_iterator(insert_index_no_check(compute_slot(hash), key, value));
+		grow(m_size + 1);
+		const index_t new_index = insert_hash_no_check(hash, std::move(key), std::move(value));
+		return make_iterator(guard_chain_length(new_index, chain_guard_t()));
+	}
+
+	// insert a range of std::pair<key_t, value_t>, see insert_bulk.
+	template <typename input_iterator_t,
+		typename = decltype(*std::declval<input_iterator_t&>()),
+		typename = decltype(++std::declval<input_iterator_t&>())>
+	void insert(input_iterator_t first, input_iterator_t last)
+	{
+		insert_range(first, last, typename std::iterator_traits<input_iterator_t>::iterator_category());
+	}
+
+	// reserve once, then insert the items ordered by their target buckets, so the home slots and the free tree
+	// are visited sequentially, and the chain heads are placed before any member could take their slots.
+	// later items replace the former ones with the same key.
+	void insert_bulk(const std::pair<key_t, value_t>* items, fhash_size_t n)
+	{
+		insert_sorted(items, n);
+	}
+
+	// the aggregation kernel, combine(value_t& value, const value_t& new_value) merges values[i] into the value of
+	// keys[i] if it exists, otherwise keys[i] is inserted with values[i].
+	// the home slots of the next batch are prefetched while the current one is probed, so the cache misses overlap.
+	// the new keys of a batch are inserted after probing all of them, growing once per batch.
+	template <typename combine_t>
+	void upsert_batch(const key_t* keys, const value_t* values, fhash_size_t n, combine_t combine)
+	{
+		precomputed_hash_t precomputed_hashes[2][upsert_batch_size];
+		hash_t hashes[upsert_batch_size];
+		fhash_size_t misses[upsert_batch_size];
+		fhash_size_t first_misses[upsert_batch_size];
+		auto prefetch_batch = [this, keys, n](precomputed_hash_t* batch_hashes, fhash_size_t begin) {
+			const fhash_size_t batch_size = std::min(n - begin, fhash_size_t(upsert_batch_size));
+			for (fhash_size_t i = 0; i < batch_size; i++)
+			{
+				batch_hashes[i] = hash_of(keys[begin + i]);
+				prefetch(batch_hashes[i]);
+			}
+		};
+		if (n > 0)
+		{
+			prefetch_batch(precomputed_hashes[0], 0);
+		}
+		for (fhash_size_t begin = 0, batch = 0; begin < n; begin += upsert_batch_size, batch ^= 1)
+		{
+			const fhash_size_t batch_size = std::min(n - begin, fhash_size_t(upsert_batch_size));
+			if (n - begin > upsert_batch_size)
+			{
+				prefetch_batch(precomputed_hashes[batch ^ 1], begin + upsert_batch_size);
+			}
+
+			fhash_size_t miss_count = 0;
+			fhash_size_t new_count = 0;
+			for (fhash_size_t i = 0; i < batch_size; i++)
+			{
+				// the seed may change between the batches, so the hash is computed here.
+				hashes[i] = compute_hash(precomputed_hashes[batch][i]);
+				const index_t index = find_hash_index(keys[begin + i], hashes[i],
+					[](index_t index) {return index; },
+					[]() {return invalid_index; });
+				if (index != invalid_index)
+				{
+					combine(get_entry(index).d.get_value(), values[begin + i]);
+					continue;
+				}
+				// a key may repeat within the batch, the later misses are combined into the first one.
+				fhash_size_t first = miss_count;
+				for (fhash_size_t j = 0; j < miss_count; j++)
+				{
+					const fhash_size_t k = misses[j];
+					if (first_misses[j] == j && hashes[k] == hashes[i] && keys[begin + k] == keys[begin + i])
+					{
+						first = j;
+						break;
+					}
+				}
+				new_count += first == miss_count;
+				first_misses[miss_count] = first;
+				misses[miss_count++] = i;
+			}
+			if (miss_count == 0)
+			{
+				continue;
+			}
+
+			grow(m_size + new_count);
+			for (fhash_size_t j = 0; j < miss_count; j++)
+			{
+				if (first_misses[j] != j)
+				{
+					continue;
+				}
+				const fhash_size_t i = misses[j];
+				value_t value = values[begin + i];
+				for (fhash_size_t k = j + 1; k < miss_count; k++)
+				{
+					if (first_misses[k] == j)
+					{
+						combine(value, values[begin + misses[k]]);
+					}
+				}
+				insert_hash_no_check(hashes[i], keys[begin + i], std::move(value));
+			}
+			// the next batch is hashed with the new seed.
+			guard_chain_length();
+		}
+	}
+
+	// moves the element into the table, replaces the value if the key exists already.
+	iterator insert(node_type&& node)
+	{
+		if (node.empty())
+		{
+			return end();
+		}
+		iterator it = insert(std::move(node.key()), std::move(node.mapped()));
+		node.reset();
+		return it;
+	}
+
+	// moves the element out of the table, returns an empty node if not found.
+	node_type extract(key_t key)
+	{
+		return find_hash_index(key, compute_hash(key),
+			[this](index_t index) {return extract(make_iterator(index)); },
+			[]() {return node_type(); });
+	}
+
+	node_type extract(iterator it)
+	{
+		node_type node;
+		if (it < end())
+		{
+			data& d = get_entry(it.m_index).d;
+			node.construct(std::move(d.get_key()), std::move(d.get_value()));
+			remove_index(it.m_index);
+		}
+		return node;
+	}
+
+	// moves all the elements of other into this table, reserving once, other is left empty.
+	// the values of other replace the existing ones with the same key.
+	void merge(fhash_table&& other)
+	{
+		merge(std::move(other), [](value_t& value, value_t&& other_value) {value = std::move(other_value); });
+	}
+
+	// combine(value_t& value, value_t&& other_value) merges the values of the keys existing in both tables.
+	template <typename combine_t>
+	void merge(fhash_table&& other, combine_t combine)
+	{
+		if (&other == this || other.m_size == 0)
+		{
+			return;
+		}
+		if (m_size == 0)
+		{
+			clear();
+			move_table(std::move(other));
+			return;
+		}
+
+		// the keys existing in both tables are combined first, so only the new ones are reserved for.
+		struct miss
+		{
+			index_t index;
+			hash_t hash;
+		};
+		std::vector<miss> misses;
+		const fhash_size_t cap = other.capacity();
+		for (fhash_size_t i = 0; i < cap; i++)
+		{
+			const entry& e = other.read_entry(index_t(i));
+			if (!e.is_data())
+			{
+				continue;
+			}
+			const hash_t hash = compute_hash(e.d.get_key());
+			const index_t index = find_hash_index(e.d.get_key(), hash,
+				[](index_t index) {return index; },
+				[]() {return invalid_index; });
+			if (index != invalid_index)
+			{
+				combine(get_entry(index).d.get_value(), std::move(other.get_entry(index_t(i)).d.get_value()));
+			}
+			else
+			{
+				misses.push_back(miss{ index_t(i), hash });
+			}
+		}
+
+		reserve(m_size + fhash_size_t(misses.size()));
+		const uint64_t seed = m_seed;
+		for (const miss& m : misses)
+		{
+			entry& e = other.get_entry(m.index);
+			// a long chain may have reseeded the table.
+			const hash_t hash = m_seed == seed ? m.hash : compute_hash(e.d.get_key());
+			insert_hash_no_check(hash, std::move(e.d.get_key()), std::move(e.d.get_value()));
+			guard_chain_length();
+		}
+		other.clear();
 	}
 
 	iterator erase(key_t key)
 	{
-		return find_index(key, compute_hash_slot(key),
+		return erase(key, hash_of(key));
+	}
+
+	iterator erase(key_t key, precomputed_hash_t precomputed_hash)
+	{
+		return find_hash_index(key, compute_hash(precomputed_hash),
 			[this](index_t index) {return erase(make_iterator(index)); },
 			[this]() {return make_iterator(capacity()); });
 	}
 
+	// erase all the elements satisfying pred(key, value) in one pass, the free tree is rebuilt only once.
+	// returns the number of erased elements.
+	template <typename predicate_t>
+	fhash_size_t erase_if(predicate_t pred)
+	{
+		return erase_marked([this, &pred](index_t index) {
+			data& d = get_entry(index).d;
+			const key_t& key = d.get_key();
+			return pred(key, d.get_value());
+		});
+	}
+
+	// erase all the keys in [first, last) in one pass, prefer erase(key) for just a few keys.
+	// returns the number of erased elements.
+	template <typename input_iterator_t>
+	fhash_size_t erase_keys(input_iterator_t first, input_iterator_t last)
+	{
+		if (m_entries == get_default_entries())
+		{
+			return 0;
+		}
+		std::vector<bool> marked(m_entries_size);
+		fhash_size_t marked_size = 0;
+		for (; first != last; ++first)
+		{
+			const index_t index = find_hash_index(*first, compute_hash(*first),
+				[](index_t index) {return index; },
+				[]() {return invalid_index; });
+			if (index != invalid_index && !marked[index.value])
+			{
+				marked[index.value] = true;
+				marked_size++;
+			}
+		}
+		if (marked_size == 0)
+		{
+			return 0;
+		}
+		return erase_marked([&marked](index_t index) {return bool(marked[index.value]); });
+	}
+
 	void validate() const
 	{
 		if (m_entries != get_default_entries())
@@ -408,9 +1414,12 @@ public:
 				{
 					if (e->d.prev == invalid_index)
 					{
-						for (; index != invalid_index; index = e->d.next, e = &get_entry(index))
+						const index_t head = index;
+						for (; index != invalid_index; index = e->d.next)
 						{
+							e = &get_entry(index);
 							assert(!visited[index.value]);
+							assert(is_home_slot(compute_hash(e->d.get_key()), head));
 							if (e->d.prev != invalid_index)
 							{
 								assert(get_entry(e->d.prev).d.next == index);
@@ -437,12 +1446,49 @@ public:
 
 	void reserve(fhash_size_t expected_size)
 	{
-		if (allocatable_bucket_size() < get_number_of_hash_buckets(expected_size) || expected_size > m_entries_size)
+		if (need_rehash(expected_size))
 		{
 			rehash(expected_size);
 		}
 	}
 
+	// elements_per_bucket100 trades memory for shorter chains, the default is
+	// allocator_policy::average_number_of_elements_per_bucket100, the entries are elements_per_bucket100% of the buckets.
+	// growth_factor100 is the size in percent to grow to when the table is full, the buckets are a power of 2 unless
+	// allocator_policy::fastrange_buckets is set, so factors up to 200 double the table. an allocated table is rehashed
+	// to apply the new parameters.
+	void set_load_parameters(int32_t elements_per_bucket100, int32_t growth_factor100 = allocator_policy::growth_factor100)
+	{
+		// every bucket needs its own entry.
+		assert(elements_per_bucket100 >= 100 && growth_factor100 > 100);
+		m_elements_per_bucket100 = elements_per_bucket100;
+		m_growth_factor100 = growth_factor100;
+		if (m_entries != get_default_entries())
+		{
+			rehash(m_size);
+		}
+	}
+
+	int32_t get_elements_per_bucket100() const
+	{
+		return m_elements_per_bucket100;
+	}
+
+	int32_t get_growth_factor100() const
+	{
+		return m_growth_factor100;
+	}
+
+	// the bytes allocated by the table, excluding the memory owned by the keys and values.
+	size_t memory_usage() const
+	{
+		if (m_entries == get_default_entries())
+		{
+			return 0;
+		}
+		return get_entries_bytes(paged_t()) + get_bucket_filter_bytes();
+	}
+
 	std::vector<fhash_size_t> get_distance_stats() const
 	{
 		std::vector<fhash_size_t> distances;
@@ -457,8 +1503,9 @@ public:
 			if (e->is_data() && e->d.prev == invalid_index)
 			{	
 				index_t prev_index = index;
-				for (; index != invalid_index; index = e->d.next, e = &get_entry(index))
+				for (; index != invalid_index; index = e->d.next)
 				{
+					e = &get_entry(index);
 					const std::make_unsigned_t<fhash_size_t> distance = std::abs((index - prev_index).value);
 					prev_index = index;
 					if (distances.size() <= distance)
@@ -472,6 +1519,66 @@ public:
 		return distances;
 	}
 
+	// the histogram of chain lengths, the last one is the longest chain.
+	std::vector<fhash_size_t> get_chain_length_stats() const
+	{
+		std::vector<fhash_size_t> lengths;
+		if (m_entries == get_default_entries())
+		{
+			return lengths;
+		}
+		for (fhash_size_t i = 0; i < m_entries_size; i++)
+		{
+			const index_t index = index_t(i);
+			const entry& e = get_entry(index);
+			if (e.is_data() && e.d.prev == invalid_index)
+			{
+				const std::make_unsigned_t<fhash_size_t> length = get_chain_length(index);
+				if (lengths.size() <= length)
+				{
+					lengths.resize(length + 1);
+				}
+				lengths[length]++;
+			}
+		}
+		return lengths;
+	}
+
+	// the histogram of the number of cache lines each chain spans, a find of the chain costs that many misses at most.
+	std::vector<fhash_size_t> get_chain_cache_line_stats() const
+	{
+		std::vector<fhash_size_t> cache_lines;
+		if (m_entries == get_default_entries())
+		{
+			return cache_lines;
+		}
+		std::vector<uintptr_t> chain_lines;
+		for (fhash_size_t i = 0; i < m_entries_size; i++)
+		{
+			index_t index = index_t(i);
+			const entry* e = &get_entry(index);
+			if (e->is_data() && e->d.prev == invalid_index)
+			{
+				chain_lines.clear();
+				for (; index != invalid_index; index = e->d.next)
+				{
+					e = &get_entry(index);
+					const uintptr_t line = uintptr_t(e) / cache_line_size;
+					if (std::find(chain_lines.begin(), chain_lines.end(), line) == chain_lines.end())
+					{
+						chain_lines.push_back(line);
+					}
+				}
+				if (cache_lines.size() <= chain_lines.size())
+				{
+					cache_lines.resize(chain_lines.size() + 1);
+				}
+				cache_lines[chain_lines.size()]++;
+			}
+		}
+		return cache_lines;
+	}
+
 	fhash_size_t size() const
 	{
 		return m_size;
@@ -494,6 +1601,12 @@ public:
 		return m_max_index.value + 1;
 	}
 
+	// the first element at or after the position, for walking the table from a saved position.
+	iterator iterator_at(fhash_size_t index)
+	{
+		return make_iterator(index);
+	}
+
 	iterator erase(iterator it)
 	{
 		if (it < end())
@@ -508,12 +1621,23 @@ public:
 
 private:
 
+	// the bounds of a paged table are aligned to the pages, so the ranges don't share a page.
+	fhash_size_t partition_bound(fhash_size_t i, fhash_size_t count) const
+	{
+		if (i >= count)
+		{
+			return capacity();
+		}
+		const fhash_size_t bound = fhash_size_t(int64_t(capacity()) * i / count);
+		return is_paged ? bound & ~fhash_size_t(page_entries - 1) : bound;
+	}
+
 	iterator make_iterator(fhash_size_t index)
 	{
 		return iterator(*this, index_t(index));
 	}
 
-	const_iterator make_const_iterator(fhash_size_t index)
+	const_iterator make_const_iterator(fhash_size_t index) const
 	{
 		return const_iterator(*this, index_t(index));
 	}
@@ -523,7 +1647,7 @@ private:
 		return iterator(*this, index);
 	}
 
-	const_iterator make_const_iterator(index_t index)
+	const_iterator make_const_iterator(index_t index) const
 	{
 		return const_iterator(*this, index);
 	}
@@ -549,58 +1673,233 @@ private:
 		return size;
 	}
 
-	hash_t compute_hash(key_t key) const
+	hash_t compute_hash(const key_t& key) const
 	{
-		return hash_t(m_hasher(key));
+		return compute_hash(hash_of(key));
+	}
+
+	hash_t compute_hash(precomputed_hash_t precomputed_hash) const
+	{
+		if (allocator_policy::max_chain_length > 0 && m_seed != 0)
+		{
+			// the murmur3 finalizer, all the 64 bits of the hash reach the bucket bits.
+			uint64_t h = uint64_t(precomputed_hash.value) ^ m_seed;
+			h ^= h >> 33;
+			h *= 0xFF51AFD7ED558CCDull;
+			h ^= h >> 33;
+			h *= 0xC4CEB9FE1A85EC53ull;
+			h ^= h >> 33;
+			return hash_t(fhash_size_t(h));
+		}
+		return hash_t(fhash_size_t(precomputed_hash.value));
 	}
 
 	index_t compute_slot(hash_t h) const
+	{
+		return compute_slot(h, fastrange_t());
+	}
+
+	index_t compute_slot(hash_t h, std::false_type) const
 	{
 		return index_t(h.value & m_bucket_size_minus_one);
 	}
 
-	index_t compute_hash_slot(key_t key)
+	// the low bits of the hash are mixed into the high ones, which select the bucket.
+	index_t compute_slot(hash_t h, std::true_type) const
 	{
-		return compute_slot(compute_hash(key));
+		return reduce_to_bucket(uint32_t(h.value) * 0x9E3779B9u, std::true_type());
 	}
 
-	void insert_empty(data& d, key_t key, value_t value)
+	index_t reduce_to_bucket(uint32_t x, std::false_type) const
 	{
-		d.construct(key, value);
-		d.next = invalid_index;
-		d.prev = invalid_index;
+		return index_t(fhash_size_t(x) & m_bucket_size_minus_one);
 	}
 
-	index_t allocate_entry(index_t index)
+	// x * buckets / 2^32 is in [0, buckets).
+	index_t reduce_to_bucket(uint32_t x, std::true_type) const
 	{
-		index_t pos = find_min_distance_node(index);
-		assert(pos != invalid_index);
-		// remove from tree.
-		remove_node(pos);
-		return pos;
+		return index_t(fhash_size_t((uint64_t(x) * uint64_t(m_bucket_size_minus_one + 1)) >> 32));
 	}
 
-	index_t insert_tail(index_t index, key_t key, value_t value)
+	bool is_home_slot(hash_t h, index_t slot) const
 	{
-		index_t new_index = allocate_entry(index);
-		index_t prev = index;
-		while (index != invalid_index)
-		{
-			prev = index;
-			index = get_entry(index).d.next;
-		}
-		data& p = get_entry(prev).d;
-		data& t = get_entry(new_index).d;
-		p.next = new_index;
-		t.prev = prev;
+		return slot == compute_slot(h) || (allocator_policy::two_choice && slot == compute_second_slot(h));
+	}
+
+	// the other bucket of the two choices, from the high bits of the hash mixed by a multiplication.
+	index_t compute_second_slot(hash_t h) const
+	{
+		const uint64_t mixed = uint64_t(h.value) * 0x9E3779B97F4A7C15ull;
+		return reduce_to_bucket(uint32_t(mixed >> 32), fastrange_t());
+	}
+
+	// the bucket to insert a new key into.
+	index_t choose_slot(hash_t h) const
+	{
+		return choose_slot(h, two_choice_t());
+	}
+
+	index_t choose_slot(hash_t h, std::false_type) const
+	{
+		return compute_slot(h);
+	}
+
+	index_t choose_slot(hash_t h, std::true_type) const
+	{
+		const index_t slot = compute_slot(h);
+		const index_t second_slot = compute_second_slot(h);
+		return get_chain_length(second_slot) < get_chain_length(slot) ? second_slot : slot;
+	}
+
+	// the length of the chain whose head is in the slot, 0 if the slot is free or holds a member of another chain.
+	fhash_size_t get_chain_length(index_t slot) const
+	{
+		fhash_size_t length = 0;
+		const entry* e = &get_entry(slot);
+		if (e->is_data() && e->d.prev == invalid_index)
+		{
+			for (index_t index = slot; index != invalid_index; index = e->d.next)
+			{
+				e = &get_entry(index);
+				length++;
+			}
+		}
+		return length;
+	}
+
+	// swaps a hit element with its predecessor, every self_organizing_period-th time, returns its new index.
+	index_t move_toward_head(index_t index)
+	{
+		if (allocator_policy::self_organizing_period == 0)
+		{
+			return index;
+		}
+		const index_t prev_index = read_entry(index).d.prev;
+		if (prev_index == invalid_index || ++m_hits_since_move < allocator_policy::self_organizing_period)
+		{
+			return index;
+		}
+		m_hits_since_move = 0;
+		data& d = get_entry(index).d;
+		data& prev = get_entry(prev_index).d;
+		std::swap(prev.get_key(), d.get_key());
+		std::swap(prev.get_value(), d.get_value());
+		return prev_index;
+	}
+
+	index_t find_chain_head(index_t index) const
+	{
+		while (get_entry(index).d.prev != invalid_index)
+		{
+			index = get_entry(index).d.prev;
+		}
+		return index;
+	}
+
+	void insert_empty(data& d, key_t key, value_t value)
+	{
+		d.construct(std::move(key), std::move(value));
+		d.next = invalid_index;
+		d.prev = invalid_index;
+	}
+
+	index_t allocate_entry(index_t index)
+	{
+		index_t pos = find_min_distance_node(index);
+		assert(pos != invalid_index);
+		// remove from tree.
+		remove_node(pos);
+		return pos;
+	}
+
+	index_t insert_tail(index_t index, key_t key, value_t value)
+	{
+		index_t new_index = allocate_entry(index);
+		index_t prev = index;
+		fhash_size_t chain_length = 1;
+		while (index != invalid_index)
+		{
+			prev = index;
+			index = read_entry(index).d.next;
+			chain_length++;
+		}
+		if (allocator_policy::max_chain_length > 0 && chain_length > allocator_policy::max_chain_length)
+		{
+			m_long_chain = true;
+		}
+		data& p = get_entry(prev).d;
+		data& t = get_entry(new_index).d;
+		p.next = new_index;
+		t.prev = prev;
 		t.next = invalid_index;
-		t.construct(key, value);
+		t.construct(std::move(key), std::move(value));
 		update_max_index(new_index);
 		return new_index;
 	}
 
+	// reseeds after an insert built a chain longer than allocator_policy::max_chain_length, returns true if it rehashed.
+	bool guard_chain_length()
+	{
+		if (!m_long_chain)
+		{
+			return false;
+		}
+		m_long_chain = false;
+		if (m_size < m_reseed_size * 2)
+		{
+			return false;
+		}
+		m_reseed_size = m_size;
+		std::random_device random;
+		do
+		{
+			m_seed = (uint64_t(random()) << 32) | random();
+		} while (m_seed == 0);
+		// keeps the entries, a bulk insert may have reserved them.
+		rehash(m_entries_size, allocatable_bucket_size());
+		m_long_chain = false;
+		return true;
+	}
+
+	index_t guard_chain_length(index_t index, std::false_type)
+	{
+		return index;
+	}
+
+	// the rehash moves the inserted element, returns its new index.
+	index_t guard_chain_length(index_t index, std::true_type)
+	{
+		if (!m_long_chain)
+		{
+			return index;
+		}
+		const key_t key = read_entry(index).d.get_key();
+		if (!guard_chain_length())
+		{
+			return index;
+		}
+		return find_hash_index(key, compute_hash(key),
+			[](index_t index) {return index; },
+			[]() {return invalid_index; });
+	}
+
+	index_t insert_hash_no_check(hash_t hash, key_t key, value_t value)
+	{
+		this->stats().on_insert();
+		return place_hash_no_check(hash, std::move(key), std::move(value));
+	}
+
+	// places the element without counting an insert, for the rehash and the copies.
+	index_t place_hash_no_check(hash_t hash, key_t key, value_t value)
+	{
+		const index_t slot = choose_slot(hash);
+		add_to_bucket_filter(hash, slot);
+		return insert_index_no_check(slot, std::move(key), std::move(value));
+	}
+
 	index_t insert_index_no_check(index_t index, key_t key, value_t value)
 	{
+		operation_scope scope(this->stats(), fhash_operation::insert);
 		entry& e = get_entry(index);
 		data& d = e.d;
 		if (e.is_data())
@@ -608,6 +1907,10 @@ private:
 			if (d.prev != invalid_index)
 			{
 				// we are list from other slot.
+				this->stats().on_insert_victim();
+				// the victim's home slot holds the head of its chain, so it goes to the tail without displacing
+				// anything else, one insert relocates at most one element.
+				const index_t victim_slot = find_chain_head(index);
 				key_t victim_key = std::move(d.get_key());
 				value_t victim_value = std::move(d.get_value());
 
@@ -615,24 +1918,26 @@ private:
 
 				const index_t unlinked_index = unlink_index(index);
 				assert(unlinked_index == index);
-				insert_empty(d, key, value);
+				insert_empty(d, std::move(key), std::move(value));
 
 				update_max_index(index);
 
-				insert_index_no_check(compute_hash_slot(victim_key), victim_key, victim_value);
+				assert(get_entry(victim_slot).is_data() && get_entry(victim_slot).d.prev == invalid_index);
+				m_size++;
+				insert_tail(victim_slot, std::move(victim_key), std::move(victim_value));
 				return index;
 			}
 			else
 			{
 				m_size++;
-				return insert_tail(index, key, value);
+				return insert_tail(index, std::move(key), std::move(value));
 			}
 		}
 		else
 		{
 			m_size++;
 			remove_node(index);
-			insert_empty(d, key, value);
+			insert_empty(d, std::move(key), std::move(value));
 			update_max_index(index);
 			return index;
 		}
@@ -662,23 +1967,287 @@ private:
 		}
 		else
 		{
-			// i'm the first, move the next to first and unlink the next.
+			// i'm the first, move the next to first and unlink the next, the next is never a head.
 			const index_t next_index = d.next;
 			if (next_index != invalid_index)
 			{
 				data& next = get_entry(next_index).d;
-				const index_t unlinked_index = unlink_index(next_index);
-				assert(unlinked_index == next_index);
+				d.next = next.next;
+				if (next.next != invalid_index)
+				{
+					get_entry(next.next).d.prev = index;
+				}
 
 				d.get_key() = std::move(next.get_key());
 				d.get_value() = std::move(next.get_value());
 				
-				index = unlinked_index;
+				index = next_index;
+			}
+			else
+			{
+				// the chain is empty now.
+				clear_bucket_filter(index);
 			}
 		}
 		return index;
 	}
 
+	template <typename input_iterator_t>
+	void insert_range(input_iterator_t first, input_iterator_t last, std::input_iterator_tag)
+	{
+		const std::vector<std::pair<key_t, value_t>> items(first, last);
+		insert_sorted(items.data(), fhash_size_t(items.size()));
+	}
+
+	template <typename random_iterator_t>
+	void insert_range(random_iterator_t first, random_iterator_t last, std::random_access_iterator_tag)
+	{
+		insert_sorted(first, fhash_size_t(last - first));
+	}
+
+	template <typename random_iterator_t>
+	void insert_sorted(random_iterator_t items, fhash_size_t n)
+	{
+		if (n == 0)
+		{
+			return;
+		}
+		// nothing to replace, n is the exact bound but for duplicated keys.
+		if (m_size == 0)
+		{
+			reserve(n);
+		}
+
+		struct slot_item
+		{
+			index_t slot;
+			fhash_size_t pos;
+			hash_t hash;
+			bool inserted;
+		};
+		std::vector<slot_item> sorted_items(n);
+		for (fhash_size_t i = 0; i < n; i++)
+		{
+			sorted_items[i].hash = compute_hash(items[i].first);
+			sorted_items[i].pos = i;
+			sorted_items[i].inserted = false;
+		}
+		auto sort_items = [this, &sorted_items]() {
+			for (slot_item& item : sorted_items)
+			{
+				item.slot = compute_slot(item.hash);
+			}
+			const fhash_size_t bucket_size = allocatable_bucket_size();
+			if (int64_t(bucket_size) > int64_t(sorted_items.size()) * 4)
+			{
+				std::sort(sorted_items.begin(), sorted_items.end(), [](const slot_item& a, const slot_item& b) {
+					return a.slot < b.slot || (a.slot == b.slot && a.pos < b.pos);
+				});
+				return;
+			}
+			// a counting sort by slot, stable so the items of a key keep their order.
+			std::vector<fhash_size_t> offsets(bucket_size + 1);
+			for (const slot_item& item : sorted_items)
+			{
+				offsets[item.slot.value + 1]++;
+			}
+			for (fhash_size_t i = 0; i < bucket_size; i++)
+			{
+				offsets[i + 1] += offsets[i];
+			}
+			std::vector<slot_item> sorted(sorted_items.size());
+			for (const slot_item& item : sorted_items)
+			{
+				sorted[offsets[item.slot.value]++] = item;
+			}
+			sorted_items.swap(sorted);
+		};
+		sort_items();
+
+		// probe every key once in slot order, the existing keys are replaced in place and a new key keeps only its
+		// last occurrence, so the distinct new keys are reserved for and inserted without probing again.
+		fhash_size_t run_begin = 0;
+		for (fhash_size_t i = 0; i < n; i++)
+		{
+			slot_item& item = sorted_items[i];
+			if (i > 0 && item.slot != sorted_items[i - 1].slot)
+			{
+				run_begin = i;
+			}
+			const key_t& key = items[item.pos].first;
+			const index_t index = find_hash_index(key, item.hash,
+				[](index_t index) {return index; },
+				[]() {return invalid_index; });
+			if (index != invalid_index)
+			{
+				get_entry(index).d.get_value() = items[item.pos].second;
+				item.inserted = true;
+				continue;
+			}
+			// the same keys are in the same slot.
+			for (fhash_size_t j = run_begin; j < i; j++)
+			{
+				slot_item& earlier = sorted_items[j];
+				if (!earlier.inserted && earlier.hash == item.hash && items[earlier.pos].first == key)
+				{
+					earlier.inserted = true;
+					break;
+				}
+			}
+		}
+		sorted_items.erase(std::remove_if(sorted_items.begin(), sorted_items.end(),
+			[](const slot_item& item) {return item.inserted; }), sorted_items.end());
+		if (sorted_items.empty())
+		{
+			return;
+		}
+		const fhash_size_t new_count = fhash_size_t(sorted_items.size());
+		const fhash_size_t bucket_size = allocatable_bucket_size();
+		reserve(m_size + new_count);
+		if (allocatable_bucket_size() != bucket_size)
+		{
+			sort_items();
+		}
+
+		// returns false if a long chain reseeded the table, the hashes of the remaining items are stale then.
+		auto insert_item = [this, &items, &sorted_items](fhash_size_t i) {
+			slot_item& item = sorted_items[i];
+			insert_hash_no_check(item.hash, items[item.pos].first, items[item.pos].second);
+			item.inserted = true;
+			return !guard_chain_length();
+		};
+		bool seeded = true;
+
+		// insert the heads first.
+		for (fhash_size_t i = 0; i < new_count && seeded; i++)
+		{
+			if (i == 0 || sorted_items[i].slot != sorted_items[i - 1].slot)
+			{
+				seeded = insert_item(i);
+			}
+		}
+
+		for (fhash_size_t i = 1; i < new_count && seeded; i++)
+		{
+			if (sorted_items[i].slot == sorted_items[i - 1].slot)
+			{
+				seeded = insert_item(i);
+			}
+		}
+
+		if (!seeded)
+		{
+			for (const slot_item& item : sorted_items)
+			{
+				if (!item.inserted)
+				{
+					insert(items[item.pos].first, items[item.pos].second);
+				}
+			}
+		}
+	}
+
+	template <typename predicate_t>
+	fhash_size_t erase_marked(predicate_t is_marked)
+	{
+		if (m_entries == get_default_entries())
+		{
+			return 0;
+		}
+
+		const fhash_size_t old_size = m_size;
+		const fhash_size_t cap = capacity();
+		for (fhash_size_t i = 0; i < cap; i++)
+		{
+			const index_t head = index_t(i);
+			entry& e = get_entry(head);
+			if (!e.is_data() || e.d.prev != invalid_index)
+			{
+				continue;
+			}
+
+			// drop the marked entries and relink the survivors in their original order.
+			index_t first = invalid_index;
+			index_t tail = invalid_index;
+			for (index_t index = head; index != invalid_index;)
+			{
+				data& d = get_entry(index).d;
+				const index_t next = d.next;
+				if (is_marked(index))
+				{
+					d.destruct();
+					release_entry(index);
+					m_size--;
+					this->stats().on_remove();
+				}
+				else
+				{
+					if (tail == invalid_index)
+					{
+						first = index;
+					}
+					else
+					{
+						get_entry(tail).d.next = index;
+						d.prev = tail;
+					}
+					tail = index;
+				}
+				index = next;
+			}
+
+			if (tail == invalid_index)
+			{
+				// the whole chain is erased, its filter bits can go.
+				clear_bucket_filter(head);
+				continue;
+			}
+			get_entry(tail).d.next = invalid_index;
+
+			if (first != head)
+			{
+				// the head is erased, move the first survivor to the head.
+				data& h = get_entry(head).d;
+				data& f = get_entry(first).d;
+				h.construct(std::move(f.get_key()), std::move(f.get_value()));
+				h.prev = invalid_index;
+				h.next = f.next;
+				if (h.next != invalid_index)
+				{
+					get_entry(h.next).d.prev = head;
+				}
+				f.destruct();
+				release_entry(first);
+			}
+		}
+
+		while (m_max_index > invalid_index && !read_entry(m_max_index).is_data()) m_max_index--;
+
+		// rebuild a balanced free tree over all the free entries.
+		std::vector<index_t> free_indices;
+		free_indices.reserve(m_entries_size - m_size);
+		for (fhash_size_t i = 0; i < m_entries_size; i++)
+		{
+			if (!read_entry(index_t(i)).is_data())
+			{
+				free_indices.push_back(index_t(i));
+			}
+		}
+		m_root = build_tree(free_indices.data(), free_indices.data() + free_indices.size());
+		if (m_root != invalid_index)
+		{
+			get_node(m_root).parent = invalid_node_index;
+		}
+		return old_size - m_size;
+	}
+
+	// mark the entry as free without touching the free tree, which is rebuilt afterwards.
+	void release_entry(index_t index)
+	{
+		node& n = get_node(index);
+		n.lchild = n.rchild = n.parent = invalid_node_index;
+	}
+
 	index_t remove_index(index_t index)
 	{
 		const index_t unlinked_index = unlink_index(index);
@@ -687,7 +2256,8 @@ private:
 		e.d.destruct();
 		add_node(unlinked_index);
 		m_size--;
-		while (m_max_index > invalid_index && !get_entry(m_max_index).is_data()) m_max_index--;
+		this->stats().on_remove();
+		while (m_max_index > invalid_index && !read_entry(m_max_index).is_data()) m_max_index--;
 		if (unlinked_index > index)
 		{
 			// unlinked an next from the future.
@@ -700,23 +2270,69 @@ private:
 	}
 
 	template <typename success_operation_t, typename failed_operation_t>
-	decltype(auto) find_index(key_t key, index_t index, success_operation_t success_operation, failed_operation_t failed_operation) const
+	decltype(auto) find_hash_index(const key_t& key, hash_t hash, success_operation_t success_operation, failed_operation_t failed_operation) const
+	{
+		return find_hash_index_if(hash, [&key](const data& d) {return d.get_key() == key; }, success_operation, failed_operation);
+	}
+
+	// looks up the chain of the home slot, and of the second slot in two choice mode.
+	template <typename predicate_t, typename success_operation_t, typename failed_operation_t>
+	decltype(auto) find_hash_index_if(hash_t hash, predicate_t pred, success_operation_t success_operation, failed_operation_t failed_operation) const
 	{
+		return find_hash_index_if(hash, pred, success_operation, failed_operation, two_choice_t());
+	}
+
+	template <typename predicate_t, typename success_operation_t, typename failed_operation_t>
+	decltype(auto) find_hash_index_if(hash_t hash, predicate_t pred, success_operation_t success_operation, failed_operation_t failed_operation, std::false_type) const
+	{
+		return find_index_if(hash, compute_slot(hash), pred, success_operation, failed_operation);
+	}
+
+	template <typename predicate_t, typename success_operation_t, typename failed_operation_t>
+	decltype(auto) find_hash_index_if(hash_t hash, predicate_t pred, success_operation_t success_operation, failed_operation_t failed_operation, std::true_type) const
+	{
+		const index_t slot = compute_slot(hash);
+		const index_t second_slot = compute_second_slot(hash);
+		// overlap the second chain's miss with the walk of the first.
+		if (second_slot != slot)
+		{
+			FHASH_PREFETCH(&entry_at(second_slot, paged_t()));
+		}
+		return find_index_if(hash, slot, pred, success_operation, [&]() -> decltype(auto) {
+			return second_slot != slot ? find_index_if(hash, second_slot, pred, success_operation, failed_operation) : failed_operation();
+		});
+	}
+
+	template <typename predicate_t, typename success_operation_t, typename failed_operation_t>
+	decltype(auto) find_index_if(hash_t hash, index_t index, predicate_t pred, success_operation_t success_operation, failed_operation_t failed_operation) const
+	{
+		operation_scope scope(this->stats(), fhash_operation::find);
+		if (!may_contain(hash, index))
+		{
+			this->stats().on_find_miss(0);
+			return failed_operation();
+		}
+		// the heads are always in their home slots, a free slot or a member of another chain means no chain.
 		const entry* e = &get_entry(index);
-		if (!e->is_data())
+		if (!e->is_data() || e->d.prev != invalid_index)
 		{
+			this->stats().on_find_miss(0);
 			return failed_operation();
 		}
 
+		fhash_size_t chain_length = 0;
 		do
 		{
-			if (e->d.get_key() == key)
+			chain_length++;
+			if (pred(e->d))
 			{
+				this->stats().on_find_hit(chain_length);
 				return success_operation(index);
 			}
 			index = e->d.next; 
 			if (index == invalid_index)
 			{
+				this->stats().on_find_miss(chain_length);
 				return failed_operation();
 			}
 			e = &get_entry(index);
@@ -741,24 +2357,63 @@ private:
 		return v;
 	}
 
-	static fhash_size_t get_number_of_hash_buckets(fhash_size_t expected_size)
+	fhash_size_t get_number_of_hash_buckets(fhash_size_t expected_size) const
+	{
+		const fhash_size_t expected_bucket_num = fhash_size_t(int64_t(expected_size) * 100 / m_elements_per_bucket100) + allocator_policy::min_number_of_hash_buckets;
+		return round_bucket_size(expected_bucket_num);
+	}
+
+	static fhash_size_t round_bucket_size(fhash_size_t bucket_size)
+	{
+		return allocator_policy::fastrange_buckets ? bucket_size : next_power_of_2(bucket_size);
+	}
+
+	bool need_rehash(fhash_size_t expected_size) const
+	{
+		return allocatable_bucket_size() < get_number_of_hash_buckets(expected_size) || expected_size > m_entries_size;
+	}
+
+	// grows the buckets by the growth factor when the table is full, instead of to the exact size.
+	void grow(fhash_size_t expected_size)
+	{
+		if (need_rehash(expected_size))
+		{
+			const fhash_size_t grown_bucket_size = fhash_size_t(int64_t(allocatable_bucket_size()) * m_growth_factor100 / 100);
+			rehash(expected_size, std::max(get_number_of_hash_buckets(expected_size), round_bucket_size(grown_bucket_size)));
+		}
+	}
+
+	size_t get_entries_bytes(std::false_type) const
 	{
-		const fhash_size_t expected_bucket_num = expected_size * 100 / allocator_policy::average_number_of_elements_per_bucket100 + allocator_policy::min_number_of_hash_buckets;
-		return next_power_of_2(expected_bucket_num);
+		return size_t(m_entries_size) * sizeof(entry);
+	}
+
+	// the shared pages are counted by every table sharing them.
+	size_t get_entries_bytes(std::true_type) const
+	{
+		const size_t page_count = size_t(get_page_count(m_entries_size));
+		return page_count * (sizeof(entry*) + page_header_size + page_entries * sizeof(entry));
 	}
 
 	void rehash(fhash_size_t expected_size)
 	{
+		rehash(expected_size, get_number_of_hash_buckets(expected_size));
+	}
+
+	void rehash(fhash_size_t expected_size, fhash_size_t bucket_size)
+	{
+		this->stats().on_rehash_begin();
 		fhash_table old_table(std::move(*this));
 
-		const fhash_size_t bucket_size = get_number_of_hash_buckets(expected_size);
+		assert(!allocator_policy::fastrange_buckets || uint64_t(bucket_size) <= (uint64_t(1) << 32));
 		m_bucket_size_minus_one = bucket_size - 1;
+		allocate_bucket_filter();
 
-		m_entries_size = std::max(bucket_size * allocator_policy::average_number_of_elements_per_bucket100 / 100, expected_size);
+		m_entries_size = std::max(fhash_size_t(int64_t(bucket_size) * m_elements_per_bucket100 / 100), expected_size);
 		// rehash shoudn't throw any data.
 		m_entries_size = std::max(m_entries_size, m_size);
 
-		m_entries = (entry*)malloc(m_entries_size * sizeof(entry));
+		allocate_entries(paged_t());
 
 		// build the tree.
 		m_root = build_tree(index_t(0), index_t(m_entries_size));
@@ -767,49 +2422,332 @@ private:
 		// now insert old data to new table.
 		if (old_table.m_entries != get_default_entries())
 		{
-			const fhash_size_t cap = old_table.capacity();
-			for (fhash_size_t i = 0; i < cap; i++)
-			{
-				entry& e = old_table.get_entry(index_t(i));
-				if (e.is_data() && e.d.prev == invalid_index)
-				{
-					insert_index_no_check(compute_hash_slot(e.d.get_key()), e.d.get_key(), e.d.get_value());
-				}
-			}
+			insert_old_entries(old_table, paged_t());
 
-			for (fhash_size_t i = 0; i < cap; i++)
-			{
-				entry& e = old_table.get_entry(index_t(i));
-				if (e.is_data() && e.d.prev != invalid_index)
-				{
-					insert_index_no_check(compute_hash_slot(e.d.get_key()), e.d.get_key(), e.d.get_value());
-				}
-			}
+			// account the freed memory to this table.
+			std::swap(this->stats(), old_table.stats());
+			old_table.clear();
+			std::swap(this->stats(), old_table.stats());
 		}
+		this->stats().on_rehash_end();
 	}
 
-private:
-
-	entry& get_entry(index_t index)
+	void insert_old_entries(fhash_table& old_table, std::false_type)
 	{
-		return m_entries[index.value];
+		insert_entries(old_table);
 	}
 
-	entry& get_entry(node_index_t node_index)
+	// the old pages may be shared with snapshots, copy instead of move.
+	void insert_old_entries(fhash_table& old_table, std::true_type)
 	{
-		return get_entry(node_index_to_index(node_index));
+		insert_entries(static_cast<const fhash_table&>(old_table));
 	}
 
-	const entry& get_entry(index_t index) const
+	// insert all the elements of other, moved if other is not const.
+	template <typename table_t>
+	void insert_entries(table_t& other)
+	{
+		// insert the heads first, so no member takes the slot of a head.
+		const fhash_size_t cap = other.capacity();
+		for (fhash_size_t i = 0; i < cap; i++)
+		{
+			auto& e = other.get_entry(index_t(i));
+			if (e.is_data() && e.d.prev == invalid_index)
+			{
+				place_hash_no_check(compute_hash(e.d.get_key()), std::move(e.d.get_key()), std::move(e.d.get_value()));
+			}
+		}
+
+		for (fhash_size_t i = 0; i < cap; i++)
+		{
+			auto& e = other.get_entry(index_t(i));
+			if (e.is_data() && e.d.prev != invalid_index)
+			{
+				place_hash_no_check(compute_hash(e.d.get_key()), std::move(e.d.get_key()), std::move(e.d.get_value()));
+			}
+		}
+	}
+
+	static constexpr fhash_size_t get_page_shift()
+	{
+		fhash_size_t shift = 0;
+		while ((fhash_size_t(1) << shift) < page_entries)
+		{
+			shift++;
+		}
+		return shift;
+	}
+
+	static fhash_size_t get_page_count(fhash_size_t entries_size)
+	{
+		return (entries_size + page_entries - 1) / page_entries;
+	}
+
+	// the reference count is stored in front of the entries of a page.
+	static constexpr size_t page_header_size = 64;
+
+	static std::atomic<int32_t>& get_page_refs(entry* page)
+	{
+		return *reinterpret_cast<std::atomic<int32_t>*>(reinterpret_cast<char*>(page) - page_header_size);
+	}
+
+	entry* allocate_page()
+	{
+		char* p = (char*)malloc(page_header_size + page_entries * sizeof(entry));
+		this->stats().on_allocate(page_header_size + page_entries * sizeof(entry));
+		new (p) std::atomic<int32_t>(1);
+		return reinterpret_cast<entry*>(p + page_header_size);
+	}
+
+	// destruct and free the page on releasing the last reference, count is the number of used entries.
+	void release_page(entry* page, fhash_size_t count)
+	{
+		if (get_page_refs(page).fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			if (!is_trivially_destructible_data)
+			{
+				for (fhash_size_t i = 0; i < count; i++)
+				{
+					if (page[i].is_data())
+					{
+						page[i].d.destruct();
+					}
+				}
+			}
+			free(reinterpret_cast<char*>(page) - page_header_size);
+			this->stats().on_free(page_header_size + page_entries * sizeof(entry));
+		}
+	}
+
+	fhash_size_t get_page_used_entries(fhash_size_t page_index) const
+	{
+		return std::min(fhash_size_t(page_entries), m_entries_size - page_index * page_entries);
+	}
+
+	entry* copy_page(fhash_size_t page_index)
+	{
+		entry* old_page = m_pages[page_index];
+		entry* new_page = allocate_page();
+		const fhash_size_t count = get_page_used_entries(page_index);
+		copy_page_entries(new_page, old_page, count, std::integral_constant<bool, is_trivially_copyable_data>());
+		m_pages[page_index] = new_page;
+		release_page(old_page, count);
+		return new_page;
+	}
+
+	void unshare_pages(std::false_type)
+	{
+	}
+
+	void unshare_pages(std::true_type)
+	{
+		if (m_entries == get_default_entries())
+		{
+			return;
+		}
+		const fhash_size_t page_count = get_page_count(m_entries_size);
+		for (fhash_size_t i = 0; i < page_count; i++)
+		{
+			if (get_page_refs(m_pages[i]).load(std::memory_order_acquire) > 1)
+			{
+				copy_page(i);
+			}
+		}
+	}
+
+	static void copy_page_entries(entry* new_page, const entry* old_page, fhash_size_t count, std::true_type)
+	{
+		memcpy((void*)new_page, old_page, count * sizeof(entry));
+	}
+
+	static void copy_page_entries(entry* new_page, const entry* old_page, fhash_size_t count, std::false_type)
+	{
+		for (fhash_size_t i = 0; i < count; i++)
+		{
+			if (old_page[i].is_data())
+			{
+				new_page[i].d.prev = old_page[i].d.prev;
+				new_page[i].d.next = old_page[i].d.next;
+				new_page[i].d.construct(old_page[i].d.get_key(), old_page[i].d.get_value());
+			}
+			else
+			{
+				new_page[i].n = old_page[i].n;
+			}
+		}
+	}
+
+	static uint8_t get_bucket_filter_bit(hash_t h)
+	{
+		return uint8_t(1u << ((uint64_t(h.value) * 0xC2B2AE3D27D4EB4Full) >> 61));
+	}
+
+	bool may_contain(hash_t h, index_t slot) const
+	{
+		return !allocator_policy::bucket_filter || (m_bucket_filter[slot.value] & get_bucket_filter_bit(h)) != 0;
+	}
+
+	void add_to_bucket_filter(hash_t h, index_t slot)
+	{
+		if (allocator_policy::bucket_filter)
+		{
+			m_bucket_filter[slot.value] |= get_bucket_filter_bit(h);
+		}
+	}
+
+	void clear_bucket_filter(index_t slot)
+	{
+		if (allocator_policy::bucket_filter)
+		{
+			m_bucket_filter[slot.value] = 0;
+		}
+	}
+
+	size_t get_bucket_filter_bytes() const
+	{
+		return m_bucket_filter == get_default_bucket_filter() ? 0 : size_t(m_bucket_size_minus_one) + 1;
+	}
+
+	void allocate_bucket_filter()
+	{
+		if (allocator_policy::bucket_filter)
+		{
+			const size_t bytes = size_t(m_bucket_size_minus_one) + 1;
+			m_bucket_filter = (uint8_t*)malloc(bytes);
+			memset(m_bucket_filter, 0, bytes);
+			this->stats().on_allocate(bytes);
+		}
+	}
+
+	void free_bucket_filter()
+	{
+		if (m_bucket_filter != get_default_bucket_filter())
+		{
+			free(m_bucket_filter);
+			this->stats().on_free(get_bucket_filter_bytes());
+			m_bucket_filter = get_default_bucket_filter();
+		}
+	}
+
+	// called before m_bucket_size_minus_one is copied.
+	void copy_bucket_filter(const fhash_table& other)
+	{
+		free_bucket_filter();
+		if (other.m_bucket_filter != get_default_bucket_filter())
+		{
+			const size_t bytes = other.get_bucket_filter_bytes();
+			m_bucket_filter = (uint8_t*)malloc(bytes);
+			memcpy(m_bucket_filter, other.m_bucket_filter, bytes);
+			this->stats().on_allocate(bytes);
+		}
+	}
+
+	void allocate_entries(std::false_type)
+	{
+		m_entries = (entry*)memory_t::allocate(m_entries_size * sizeof(entry));
+		this->stats().on_allocate(m_entries_size * sizeof(entry));
+	}
+
+	void allocate_entries(std::true_type)
+	{
+		const fhash_size_t page_count = get_page_count(m_entries_size);
+		m_pages = (entry**)malloc(page_count * sizeof(entry*));
+		this->stats().on_allocate(page_count * sizeof(entry*));
+		for (fhash_size_t i = 0; i < page_count; i++)
+		{
+			m_pages[i] = allocate_page();
+		}
+		// in paged mode m_entries only tells whether the table is allocated.
+		m_entries = nullptr;
+	}
+
+	void free_entries(std::false_type)
+	{
+		if (!is_trivially_destructible_data)
+		{
+			for (fhash_size_t i = 0; i < m_entries_size; i++)
+			{
+				entry& e = m_entries[i];
+				if (e.is_data())
+				{
+					e.d.destruct();
+				}
+			}
+		}
+		memory_t::deallocate(m_entries, m_entries_size * sizeof(entry));
+		this->stats().on_free(m_entries_size * sizeof(entry));
+	}
+
+	void free_entries(std::true_type)
+	{
+		const fhash_size_t page_count = get_page_count(m_entries_size);
+		for (fhash_size_t i = 0; i < page_count; i++)
+		{
+			release_page(m_pages[i], get_page_used_entries(i));
+		}
+		free(m_pages);
+		this->stats().on_free(page_count * sizeof(entry*));
+	}
+
+	entry& entry_at(index_t index, std::false_type)
+	{
+		return m_entries[index.value];
+	}
+
+	// copy the page before the first write if it is shared.
+	entry& entry_at(index_t index, std::true_type)
+	{
+		const fhash_size_t page_index = index.value >> get_page_shift();
+		entry* page = m_pages[page_index];
+		if (get_page_refs(page).load(std::memory_order_acquire) > 1)
+		{
+			page = copy_page(page_index);
+		}
+		return page[index.value & (page_entries - 1)];
+	}
+
+	const entry& entry_at(index_t index, std::false_type) const
 	{
 		return m_entries[index.value];
 	}
 
+	const entry& entry_at(index_t index, std::true_type) const
+	{
+		return m_pages[index.value >> get_page_shift()][index.value & (page_entries - 1)];
+	}
+
+private:
+
+	entry& get_entry(index_t index)
+	{
+		entry& e = entry_at(index, paged_t());
+		this->stats().on_touch(&e, sizeof(entry));
+		return e;
+	}
+
+	entry& get_entry(node_index_t node_index)
+	{
+		return get_entry(node_index_to_index(node_index));
+	}
+
+	const entry& get_entry(index_t index) const
+	{
+		const entry& e = entry_at(index, paged_t());
+		this->stats().on_touch(&e, sizeof(entry));
+		return e;
+	}
+
 	const entry& get_entry(node_index_t node_index) const
 	{
 		return get_entry(node_index_to_index(node_index));
 	}
 
+	// the non-const get_entry copies a shared page, the read paths of the non-const members use this one.
+	const entry& read_entry(index_t index) const
+	{
+		return get_entry(index);
+	}
+
 	node& get_node(index_t index)
 	{
 		return get_entry(index).n;
@@ -838,11 +2776,29 @@ private:
 			return invalid_index;
 		}
 		const index_t mid = (begin + end) / index_t(2);
-		node& root = get_node(mid);
-
 		const index_t lchild = build_tree(begin, mid);
 		const index_t rchild = build_tree(mid + index_t(1), end);
+		link_children(mid, lchild, rchild);
+		return mid;
+	}
+
+	// build the tree over sorted free indices.
+	index_t build_tree(const index_t* begin, const index_t* end)
+	{
+		if (begin == end)
+		{
+			return invalid_index;
+		}
+		const index_t* mid = begin + (end - begin) / 2;
+		const index_t lchild = build_tree(begin, mid);
+		const index_t rchild = build_tree(mid + 1, end);
+		link_children(*mid, lchild, rchild);
+		return *mid;
+	}
 
+	void link_children(index_t mid, index_t lchild, index_t rchild)
+	{
+		node& root = get_node(mid);
 		if (lchild != invalid_index)
 		{
 			get_node(lchild).parent = index_to_node_index(mid);
@@ -862,8 +2818,6 @@ private:
 		{
 			root.rchild = invalid_node_index;
 		}
-
-		return mid;
 	}
 
 	index_t get_node_dir(node_index_t index)
@@ -910,6 +2864,7 @@ private:
 
 	void remove_node(index_t erased_index)
 	{
+		operation_scope scope(this->stats(), fhash_operation::free_tree_walk);
 		const node_index_t erased_node_index = index_to_node_index(erased_index);
 
 		// copied from std::_Tree_val::_Extract
@@ -986,7 +2941,7 @@ private:
 		}
 	}
 
-	index_t find_insert_node(index_t index, index_t& last_dir) const
+	index_t find_insert_node(index_t index, index_t& last_dir, fhash_size_t& depth) const
 	{
 		index_t prev = invalid_index;
 		index_t current = m_root;
@@ -994,6 +2949,7 @@ private:
 		{
 			const node& n = get_node(current);
 			prev = current;
+			depth++;
 			if (index == current)
 			{
 				return index;
@@ -1014,18 +2970,23 @@ private:
 
 	index_t find_min_distance_node(index_t index) const
 	{
+		operation_scope scope(this->stats(), fhash_operation::free_tree_walk);
 		index_t current = m_root;
-		fhash_size_t min_distance = std::numeric_limits<fhash_size_t>::max();
+		uint64_t min_distance = std::numeric_limits<uint64_t>::max();
 		index_t min_distance_index = invalid_index;
+		fhash_size_t depth = 0;
 		while (current != invalid_index)
 		{
 			const node& n = get_node(current);
+			depth++;
 			if (index == current)
 			{
+				this->stats().on_free_tree_search(depth);
 				return current;
 			}
 
-			const fhash_size_t distance = std::abs((index - current).value);
+			// the nearest free slots on both sides are on the search path, so are the ones in the same cache line.
+			const uint64_t distance = get_allocation_cost(index, current, cache_line_aware_t());
 			if (distance < min_distance)
 			{
 				min_distance_index = current;
@@ -1041,13 +3002,38 @@ private:
 				current = node_index_to_index_check_invalid(n.rchild);
 			}
 		}
+		this->stats().on_free_tree_search(depth);
 		return min_distance_index;
 	}
 
+	uint64_t get_allocation_cost(index_t index, index_t free_index, std::false_type) const
+	{
+		return uint64_t(std::abs((index - free_index).value));
+	}
+
+	// the distance, ranked by sharing the cache line, then the page with the index.
+	uint64_t get_allocation_cost(index_t index, index_t free_index, std::true_type) const
+	{
+		const uintptr_t address = uintptr_t(&entry_at(index, paged_t()));
+		const uintptr_t free_address = uintptr_t(&entry_at(free_index, paged_t()));
+		uint64_t tier = 2;
+		if (address / cache_line_size == free_address / cache_line_size)
+		{
+			tier = 0;
+		}
+		else if (address / memory_page_size == free_address / memory_page_size)
+		{
+			tier = 1;
+		}
+		return (tier << 48) | uint64_t(std::abs((index - free_index).value));
+	}
+
 	void add_node(index_t index)
 	{
+		operation_scope scope(this->stats(), fhash_operation::free_tree_walk);
 		index_t last_dir;
-		index_t insert_index = find_insert_node(index, last_dir);
+		fhash_size_t depth = 0;
+		index_t insert_index = find_insert_node(index, last_dir, depth);
 		if (insert_index == invalid_index)
 		{
 			assert(m_root == invalid_index);
@@ -1064,6 +3050,88 @@ private:
 		assert(child_index == invalid_node_index);
 		child_index = index_to_node_index(index);
 		n.parent = index_to_node_index(insert_index);
+		rebalance_tree(index, depth + 1);
+	}
+
+	// the free tree is a plain binary search tree, freeing the entries in index order, e.g. erasing while iterating,
+	// degenerates it into a list. when a new node is too deep, rebuild the subtree of its first ancestor
+	// whose child is too heavy (scapegoat tree), which keeps the depth O(log n) at an amortized O(log n) cost.
+	void rebalance_tree(index_t index, fhash_size_t depth)
+	{
+		const fhash_size_t tree_size = m_entries_size - m_size;
+		fhash_size_t max_depth = 2;
+		for (fhash_size_t n = tree_size; n > 1; n >>= 1)
+		{
+			max_depth += 2;
+		}
+		if (depth <= max_depth)
+		{
+			return;
+		}
+		std::vector<index_t> subtree;
+		index_t child = index;
+		fhash_size_t child_size = 1;
+		while (get_node(child).parent != invalid_node_index)
+		{
+			const index_t parent = node_index_to_index(get_node(child).parent);
+			const node& p = get_node(parent);
+			const node_index_t sibling = p.lchild == index_to_node_index(child) ? p.rchild : p.lchild;
+			subtree.clear();
+			collect_subtree(sibling, subtree);
+			const fhash_size_t parent_size = child_size + 1 + fhash_size_t(subtree.size());
+			// the child holds more than 1/sqrt(2) of the nodes, a tree with no such child is shallower than max_depth.
+			if (int64_t(child_size) * child_size * 2 > int64_t(parent_size) * parent_size)
+			{
+				rebuild_subtree(parent, subtree);
+				return;
+			}
+			child = parent;
+			child_size = parent_size;
+		}
+	}
+
+	// appends the indices of the subtree in order.
+	void collect_subtree(node_index_t root, std::vector<index_t>& indices) const
+	{
+		std::vector<node_index_t> stack;
+		node_index_t current = root;
+		while (current != invalid_node_index || !stack.empty())
+		{
+			while (current != invalid_node_index)
+			{
+				stack.push_back(current);
+				current = get_node(current).lchild;
+			}
+			current = stack.back();
+			stack.pop_back();
+			indices.push_back(node_index_to_index(current));
+			current = get_node(current).rchild;
+		}
+	}
+
+	void rebuild_subtree(index_t root, std::vector<index_t>& indices)
+	{
+		const node_index_t parent = get_node(root).parent;
+		indices.clear();
+		collect_subtree(index_to_node_index(root), indices);
+		const index_t new_root = build_tree(indices.data(), indices.data() + indices.size());
+		get_node(new_root).parent = parent;
+		if (parent == invalid_node_index)
+		{
+			m_root = new_root;
+		}
+		else
+		{
+			node& p = get_node(parent);
+			if (p.lchild == index_to_node_index(root))
+			{
+				p.lchild = index_to_node_index(new_root);
+			}
+			else
+			{
+				p.rchild = index_to_node_index(new_root);
+			}
+		}
 	}
 
 	fhash_size_t allocatable_bucket_size() const
@@ -1094,14 +3162,41 @@ private:
 		return default_entries.get_entries();
 	}
 
+	// all zero, nothing is in the empty table.
+	static uint8_t* get_default_bucket_filter()
+	{
+		static uint8_t default_bucket_filter[allocator_policy::min_number_of_hash_buckets] = {};
+		return default_bucket_filter;
+	}
+
+	static no_pages get_default_pages(std::false_type)
+	{
+		return no_pages();
+	}
+
+	// the default entries are the only page of an empty table, they are never written.
+	static entry** get_default_pages(std::true_type)
+	{
+		static entry* default_pages[1] = { get_default_entries() };
+		return default_pages;
+	}
+
 private:
 	entry* m_entries = get_default_entries();
+	pages_t m_pages = get_default_pages(paged_t());
 	hasher_t m_hasher;
 	fhash_size_t m_entries_size = allocator_policy::min_number_of_entries;
 	fhash_size_t m_bucket_size_minus_one = allocator_policy::min_number_of_hash_buckets - 1;
 	fhash_size_t m_size = 0;
 	index_t m_root = invalid_index;
 	index_t m_max_index = invalid_index;
+	uint8_t* m_bucket_filter = get_default_bucket_filter();
+	int32_t m_hits_since_move = 0;
+	uint64_t m_seed = 0;
+	fhash_size_t m_reseed_size = 0;
+	bool m_long_chain = false;
+	int32_t m_elements_per_bucket100 = allocator_policy::average_number_of_elements_per_bucket100;
+	int32_t m_growth_factor100 = allocator_policy::growth_factor100;
 };
 
 template <typename key_t, typename value_t, typename hasher_t, typename allocator_policy>
@@ -1112,3 +3207,1155 @@ template <typename key_t, typename value_t, typename hasher_t, typename allocato
 constexpr typename fhash_table<key_t, value_t, hasher_t, allocator_policy>::node_index_t 
 	fhash_table<key_t, value_t, hasher_t, allocator_policy>::invalid_node_index;
 
+
+// splits the elements by the high bits of the hash into 2^segment_bits fhash_tables, each one grows on its own
+// and keeps 32-bit indices, so the total size may go far beyond 2^31 without using int64_t as fhash_size_t.
+template <typename key_t, typename value_t, int32_t segment_bits = 8, typename hasher_t = std::hash<key_t>, typename allocator_policy = fhash_default_allocator_policy>
+class fhash_segmented_table
+{
+public:
+	using table_t = fhash_table<key_t, value_t, hasher_t, allocator_policy>;
+	using iterator = typename table_t::iterator;
+	using precomputed_hash_t = typename table_t::precomputed_hash_t;
+	static constexpr size_t segment_count = size_t(1) << segment_bits;
+	static_assert(segment_bits > 0 && segment_bits < 32, "segment_bits must be in [1, 31]");
+
+	fhash_segmented_table()
+		: m_segments(segment_count)
+	{
+	}
+
+	precomputed_hash_t hash_of(const key_t& key) const
+	{
+		return m_segments[0].hash_of(key);
+	}
+
+	const value_t* find(const key_t& key) const
+	{
+		const precomputed_hash_t precomputed_hash = hash_of(key);
+		return get_segment(precomputed_hash).find(key, precomputed_hash);
+	}
+
+	value_t* find(const key_t& key)
+	{
+		const precomputed_hash_t precomputed_hash = hash_of(key);
+		return get_segment(precomputed_hash).find(key, precomputed_hash);
+	}
+
+	// returns the iterator of the segment holding the element.
+	iterator insert(key_t key, value_t value)
+	{
+		const precomputed_hash_t precomputed_hash = hash_of(key);
+		return get_segment(precomputed_hash).insert(std::move(key), std::move(value), precomputed_hash);
+	}
+
+	// returns true if the key was erased.
+	bool erase(const key_t& key)
+	{
+		const precomputed_hash_t precomputed_hash = hash_of(key);
+		table_t& segment = get_segment(precomputed_hash);
+		const auto old_size = segment.size();
+		segment.erase(key, precomputed_hash);
+		return segment.size() != old_size;
+	}
+
+	// spreads the expected size over the segments.
+	void reserve(size_t expected_size)
+	{
+		const size_t segment_size = expected_size / segment_count + 1;
+		for (table_t& segment : m_segments)
+		{
+			segment.reserve(typename table_t::fhash_size_t(segment_size));
+		}
+	}
+
+	void clear()
+	{
+		for (table_t& segment : m_segments)
+		{
+			segment.clear();
+		}
+	}
+
+	size_t size() const
+	{
+		size_t size = 0;
+		for (const table_t& segment : m_segments)
+		{
+			size += size_t(segment.size());
+		}
+		return size;
+	}
+
+	// calls fn(key, value) for every element, segment by segment.
+	template <typename function_t>
+	void for_each(function_t fn)
+	{
+		for (table_t& segment : m_segments)
+		{
+			for (auto it = segment.begin(); it; ++it)
+			{
+				fn(it.key(), it.value());
+			}
+		}
+	}
+
+	table_t& segment(size_t i)
+	{
+		return m_segments[i];
+	}
+
+	const table_t& segment(size_t i) const
+	{
+		return m_segments[i];
+	}
+
+	void validate() const
+	{
+		for (size_t i = 0; i < segment_count; i++)
+		{
+			m_segments[i].validate();
+		}
+	}
+
+private:
+	// the segments use the low bits of the hash for their slots, so mix the hash before taking the high bits.
+	static size_t get_segment_index(precomputed_hash_t precomputed_hash)
+	{
+		return size_t((uint64_t(precomputed_hash.value) * 0x9E3779B97F4A7C15ull) >> (64 - segment_bits));
+	}
+
+	table_t& get_segment(precomputed_hash_t precomputed_hash)
+	{
+		return m_segments[get_segment_index(precomputed_hash)];
+	}
+
+	const table_t& get_segment(precomputed_hash_t precomputed_hash) const
+	{
+		return m_segments[get_segment_index(precomputed_hash)];
+	}
+
+private:
+	std::vector<table_t> m_segments;
+};
+
+// keeps the elements packed in a vector in insertion order, a fhash_table of positions into the vector is the index.
+// iterating is a linear scan of the pairs and the values never move during rehash. erase moves the last element
+// into the hole, so erasing breaks the insertion order of the last element.
+template <typename key_t, typename value_t, typename hasher_t = std::hash<key_t>, typename allocator_policy = fhash_default_allocator_policy>
+class fhash_dense_map
+{
+public:
+	using value_type = std::pair<key_t, value_t>;
+	using iterator = typename std::vector<value_type>::iterator;
+	using const_iterator = typename std::vector<value_type>::const_iterator;
+	using fhash_size_t = typename fhash_policy_traits<allocator_policy>::fhash_size_t;
+
+	fhash_dense_map()
+		: m_index(index_hasher{ this })
+	{
+	}
+
+	fhash_dense_map(const fhash_dense_map& other)
+		: m_items(other.m_items)
+		, m_hasher(other.m_hasher)
+		, m_index(other.m_index)
+	{
+		m_index.hash_function().map = this;
+	}
+
+	fhash_dense_map(fhash_dense_map&& other)
+		: m_items(std::move(other.m_items))
+		, m_hasher(std::move(other.m_hasher))
+		, m_index(std::move(other.m_index))
+	{
+		m_index.hash_function().map = this;
+		other.m_items.clear();
+	}
+
+	fhash_dense_map& operator = (const fhash_dense_map& other)
+	{
+		if (this != &other)
+		{
+			m_items = other.m_items;
+			m_hasher = other.m_hasher;
+			m_index = other.m_index;
+			m_index.hash_function().map = this;
+		}
+		return *this;
+	}
+
+	fhash_dense_map& operator = (fhash_dense_map&& other)
+	{
+		if (this != &other)
+		{
+			m_items = std::move(other.m_items);
+			m_hasher = std::move(other.m_hasher);
+			m_index = std::move(other.m_index);
+			m_index.hash_function().map = this;
+			other.m_items.clear();
+		}
+		return *this;
+	}
+
+	iterator begin() { return m_items.begin(); }
+	iterator end() { return m_items.end(); }
+	const_iterator begin() const { return m_items.begin(); }
+	const_iterator end() const { return m_items.end(); }
+
+	const value_type* data() const
+	{
+		return m_items.data();
+	}
+
+	fhash_size_t size() const
+	{
+		return fhash_size_t(m_items.size());
+	}
+
+	const value_t* find(const key_t& key) const
+	{
+		const fhash_size_t position = find_position(key, m_hasher(key));
+		return position >= 0 ? &m_items[position].second : nullptr;
+	}
+
+	value_t* find(const key_t& key)
+	{
+		const fhash_size_t position = find_position(key, m_hasher(key));
+		return position >= 0 ? &m_items[position].second : nullptr;
+	}
+
+	// replaces the value if the key already exists, returns the iterator of the element.
+	iterator insert(key_t key, value_t value)
+	{
+		const size_t hash = m_hasher(key);
+		const fhash_size_t position = find_position(key, hash);
+		if (position >= 0)
+		{
+			m_items[position].second = std::move(value);
+			return m_items.begin() + position;
+		}
+		const fhash_size_t new_position = size();
+		m_items.emplace_back(std::move(key), std::move(value));
+		m_index.insert(new_position, fhash_size_t(hash), index_precomputed_hash_t{ hash });
+		return m_items.begin() + new_position;
+	}
+
+	// returns true if the key was erased.
+	bool erase(const key_t& key)
+	{
+		const size_t hash = m_hasher(key);
+		auto it = find_index_entry(key, hash);
+		if (!it)
+		{
+			return false;
+		}
+		const fhash_size_t position = it.key();
+		m_index.erase(it);
+		const fhash_size_t last = size() - 1;
+		if (position != last)
+		{
+			// move the last element into the hole and point its index entry to the new position.
+			const size_t last_hash = m_hasher(m_items[last].first);
+			auto last_it = m_index.find_if(index_precomputed_hash_t{ last_hash },
+				[last](fhash_size_t p, fhash_size_t) {return p == last; });
+			assert(last_it);
+			m_items[position] = std::move(m_items[last]);
+			last_it.key() = position;
+		}
+		m_items.pop_back();
+		return true;
+	}
+
+	void reserve(fhash_size_t expected_size)
+	{
+		m_items.reserve(expected_size);
+		m_index.reserve(expected_size);
+	}
+
+	void clear()
+	{
+		m_index.clear();
+		m_items.clear();
+	}
+
+	void validate() const
+	{
+		assert(m_index.size() == size());
+		for (fhash_size_t i = 0; i < size(); i++)
+		{
+			assert(find_position(m_items[i].first, m_hasher(m_items[i].first)) == i);
+		}
+		m_index.validate();
+	}
+
+private:
+	// hashes a position by the key stored there, so the index can rehash without storing the keys.
+	struct index_hasher
+	{
+		size_t operator()(fhash_size_t position) const
+		{
+			return map->m_hasher(map->m_items[position].first);
+		}
+
+		const fhash_dense_map* map;
+	};
+
+	// the values of the index are the low bits of the hashes, compared before touching the keys.
+	using index_table_t = fhash_table<fhash_size_t, fhash_size_t, index_hasher, allocator_policy>;
+	using index_precomputed_hash_t = typename index_table_t::precomputed_hash_t;
+
+	template <typename index_table_ref_t>
+	static auto find_index_entry(index_table_ref_t& index, const std::vector<value_type>& items, const key_t& key, size_t hash)
+	{
+		return index.find_if(index_precomputed_hash_t{ hash },
+			[&items, &key, hash](fhash_size_t position, fhash_size_t tag) {
+				return tag == fhash_size_t(hash) && items[position].first == key;
+			});
+	}
+
+	typename index_table_t::iterator find_index_entry(const key_t& key, size_t hash)
+	{
+		return find_index_entry(m_index, m_items, key, hash);
+	}
+
+	fhash_size_t find_position(const key_t& key, size_t hash) const
+	{
+		auto it = find_index_entry(m_index, m_items, key, hash);
+		return it ? it.key() : -1;
+	}
+
+private:
+	std::vector<value_type> m_items;
+	hasher_t m_hasher;
+	index_table_t m_index;
+};
+
+// a fixed capacity cache evicting with the CLOCK algorithm, the table is reserved once and never rehashes.
+// the reference bit lives next to the value instead of in a side array, because the elements move between entries
+// on erase and displacement. a hit is a find plus setting the bit. with_ttl adds an expire time to every element.
+template <typename key_t, typename value_t, bool with_ttl = false, typename hasher_t = std::hash<key_t>, typename allocator_policy = fhash_default_allocator_policy>
+class fhash_cache
+{
+public:
+	using fhash_size_t = typename fhash_policy_traits<allocator_policy>::fhash_size_t;
+	using steady_clock_t = std::chrono::steady_clock;
+
+	explicit fhash_cache(fhash_size_t capacity, steady_clock_t::duration ttl = steady_clock_t::duration::max())
+		: m_capacity(capacity)
+		, m_ttl(ttl)
+	{
+		assert(capacity > 0);
+		m_table.reserve(capacity);
+	}
+
+	value_t* find(const key_t& key)
+	{
+		slot_t* s = m_table.find(key);
+		if (s == nullptr)
+		{
+			return nullptr;
+		}
+		if (is_expired(*s, now(std::integral_constant<bool, with_ttl>())))
+		{
+			m_table.erase(key);
+			return nullptr;
+		}
+		s->referenced = true;
+		return &s->value;
+	}
+
+	// evicts an element if the cache is full, replaces the value if the key exists.
+	value_t& insert(key_t key, value_t value)
+	{
+		return insert(std::move(key), std::move(value), m_ttl);
+	}
+
+	value_t& insert(key_t key, value_t value, steady_clock_t::duration ttl)
+	{
+		slot_t* s = m_table.find(key);
+		if (s != nullptr)
+		{
+			s->referenced = true;
+		}
+		else
+		{
+			if (m_table.size() >= m_capacity)
+			{
+				evict();
+			}
+			s = &m_table.insert(std::move(key), slot_t()).value();
+		}
+		s->value = std::move(value);
+		set_expire_time(*s, ttl, std::integral_constant<bool, with_ttl>());
+		return s->value;
+	}
+
+	bool erase(const key_t& key)
+	{
+		const fhash_size_t old_size = m_table.size();
+		m_table.erase(key);
+		return m_table.size() != old_size;
+	}
+
+	void clear()
+	{
+		m_table.clear();
+		m_table.reserve(m_capacity);
+		m_hand = 0;
+	}
+
+	fhash_size_t size() const
+	{
+		return m_table.size();
+	}
+
+	fhash_size_t capacity() const
+	{
+		return m_capacity;
+	}
+
+	uint64_t get_evictions() const
+	{
+		return m_evictions;
+	}
+
+	void validate() const
+	{
+		assert(m_table.size() <= m_capacity);
+		m_table.validate();
+	}
+
+private:
+	struct slot
+	{
+		value_t value;
+		bool referenced = false;
+	};
+
+	struct ttl_slot : slot
+	{
+		steady_clock_t::time_point expire_time;
+	};
+
+	using slot_t = typename std::conditional<with_ttl, ttl_slot, slot>::type;
+	using table_t = fhash_table<key_t, slot_t, hasher_t, allocator_policy>;
+
+	static steady_clock_t::time_point now(std::false_type)
+	{
+		return steady_clock_t::time_point();
+	}
+
+	static steady_clock_t::time_point now(std::true_type)
+	{
+		return steady_clock_t::now();
+	}
+
+	static bool is_expired(const slot&, steady_clock_t::time_point)
+	{
+		return false;
+	}
+
+	static bool is_expired(const ttl_slot& s, steady_clock_t::time_point now)
+	{
+		return s.expire_time <= now;
+	}
+
+	static void set_expire_time(slot_t&, steady_clock_t::duration, std::false_type)
+	{
+	}
+
+	static void set_expire_time(slot_t& s, steady_clock_t::duration ttl, std::true_type)
+	{
+		const steady_clock_t::time_point t = steady_clock_t::now();
+		s.expire_time = ttl < steady_clock_t::time_point::max() - t ? t + ttl : steady_clock_t::time_point::max();
+	}
+
+	// sweeps the hand clearing the reference bits until an unreferenced or expired element is found.
+	void evict()
+	{
+		const steady_clock_t::time_point t = now(std::integral_constant<bool, with_ttl>());
+		auto it = m_table.iterator_at(m_hand);
+		while (true)
+		{
+			if (!it)
+			{
+				it = m_table.begin();
+			}
+			slot_t& s = it.value();
+			if (s.referenced && !is_expired(s, t))
+			{
+				s.referenced = false;
+				++it;
+				continue;
+			}
+			// erasing may move the next element of the chain into this entry, the hand visits it next.
+			m_hand = it.index();
+			m_table.erase(it);
+			m_evictions++;
+			return;
+		}
+	}
+
+private:
+	table_t m_table;
+	fhash_size_t m_capacity;
+	steady_clock_t::duration m_ttl;
+	fhash_size_t m_hand = 0;
+	uint64_t m_evictions = 0;
+};
+
+// a hasher usable in constant expressions, the identity for integers like std::hash, FNV-1a for C strings.
+template <typename key_t>
+struct fhash_constexpr_hash
+{
+	constexpr size_t operator()(key_t key) const
+	{
+		return size_t(key);
+	}
+};
+
+template <>
+struct fhash_constexpr_hash<const char*>
+{
+	constexpr size_t operator()(const char* key) const
+	{
+		uint64_t h = 14695981039346656037ull;
+		for (; *key != 0; key++)
+		{
+			h = (h ^ uint8_t(*key)) * 1099511628211ull;
+		}
+		return size_t(h);
+	}
+};
+
+template <typename key_t>
+struct fhash_constexpr_equal
+{
+	constexpr bool operator()(const key_t& lhs, const key_t& rhs) const
+	{
+		return lhs == rhs;
+	}
+};
+
+template <>
+struct fhash_constexpr_equal<const char*>
+{
+	constexpr bool operator()(const char* lhs, const char* rhs) const
+	{
+		for (; *lhs != 0 && *lhs == *rhs; lhs++, rhs++);
+		return *lhs == *rhs;
+	}
+};
+
+// a read-only table built in a constant expression, so the entries, chains and all, are laid out at compile time
+// and a static constexpr table lives in .rodata. the layout is the one of fhash_table without free slots:
+// the buckets are the largest power of 2 not above N, every chain head is in its home slot and the other
+// elements are in the nearest free entries. find walks the chain like fhash_table::find.
+// use make_fhash_static_table to deduce N. duplicated keys keep the last value.
+template <typename key_t, typename value_t, size_t N, typename hasher_t = fhash_constexpr_hash<key_t>, typename equal_t = fhash_constexpr_equal<key_t>>
+class fhash_static_table
+{
+public:
+	static_assert(N > 0 && N < (size_t(1) << 30), "N must be in [1, 2^30)");
+	using value_type = std::pair<key_t, value_t>;
+
+private:
+	static constexpr int32_t get_bucket_size(int32_t n)
+	{
+		int32_t buckets = 1;
+		while (buckets * 2 <= n)
+		{
+			buckets *= 2;
+		}
+		return buckets;
+	}
+
+public:
+	static constexpr int32_t entries_size = int32_t(N);
+	static constexpr int32_t bucket_size = get_bucket_size(int32_t(N));
+
+	constexpr fhash_static_table(const value_type (&items)[N])
+		: m_entries()
+	{
+		// insert the heads first, so no element is ever displaced.
+		for (size_t i = 0; i < N; i++)
+		{
+			const int32_t slot = compute_slot(items[i].first);
+			entry& e = m_entries[slot];
+			if (e.prev == free_index)
+			{
+				e.key = items[i].first;
+				e.value = items[i].second;
+				e.prev = invalid_index;
+				m_size++;
+			}
+			else if (e.prev == invalid_index && equal_t()(e.key, items[i].first))
+			{
+				e.value = items[i].second;
+			}
+		}
+		for (size_t i = 0; i < N; i++)
+		{
+			const int32_t slot = compute_slot(items[i].first);
+			int32_t tail = slot;
+			bool found = false;
+			for (int32_t index = slot; index != invalid_index; index = m_entries[index].next)
+			{
+				if (equal_t()(m_entries[index].key, items[i].first))
+				{
+					m_entries[index].value = items[i].second;
+					found = true;
+					break;
+				}
+				tail = index;
+			}
+			if (!found)
+			{
+				const int32_t index = find_min_distance_free(slot);
+				entry& e = m_entries[index];
+				e.key = items[i].first;
+				e.value = items[i].second;
+				e.prev = tail;
+				m_entries[tail].next = index;
+				m_size++;
+			}
+		}
+	}
+
+	constexpr const value_t* find(const key_t& key) const
+	{
+		const int32_t index = find_index(key);
+		return index != invalid_index ? &m_entries[index].value : nullptr;
+	}
+
+	constexpr bool contains(const key_t& key) const
+	{
+		return find_index(key) != invalid_index;
+	}
+
+	// the value or default_value if not found, for using the table in constant expressions.
+	constexpr value_t get(const key_t& key, value_t default_value) const
+	{
+		const int32_t index = find_index(key);
+		return index != invalid_index ? m_entries[index].value : default_value;
+	}
+
+	constexpr int32_t size() const
+	{
+		return m_size;
+	}
+
+	// the length of the chain of the key's slot, for checking the layout at compile time.
+	constexpr int32_t chain_length(const key_t& key) const
+	{
+		int32_t length = 0;
+		const int32_t slot = compute_slot(key);
+		if (m_entries[slot].prev == invalid_index)
+		{
+			for (int32_t index = slot; index != invalid_index; index = m_entries[index].next)
+			{
+				length++;
+			}
+		}
+		return length;
+	}
+
+private:
+	static constexpr int32_t invalid_index = -1;
+	static constexpr int32_t free_index = -2;
+
+	struct entry
+	{
+		constexpr entry()
+			: key()
+			, value()
+			, next(invalid_index)
+			, prev(free_index)
+		{
+		}
+
+		key_t key;
+		value_t value;
+		int32_t next;
+		// invalid_index for the chain heads, free_index for the unused entries.
+		int32_t prev;
+	};
+
+	static constexpr int32_t compute_slot(const key_t& key)
+	{
+		return int32_t(hasher_t()(key)) & (bucket_size - 1);
+	}
+
+	constexpr int32_t find_min_distance_free(int32_t index) const
+	{
+		for (int32_t distance = 1; distance < entries_size; distance++)
+		{
+			if (index - distance >= 0 && m_entries[index - distance].prev == free_index)
+			{
+				return index - distance;
+			}
+			if (index + distance < entries_size && m_entries[index + distance].prev == free_index)
+			{
+				return index + distance;
+			}
+		}
+		return invalid_index;
+	}
+
+	constexpr int32_t find_index(const key_t& key) const
+	{
+		int32_t index = compute_slot(key);
+		if (m_entries[index].prev == free_index)
+		{
+			return invalid_index;
+		}
+		for (; index != invalid_index; index = m_entries[index].next)
+		{
+			if (equal_t()(m_entries[index].key, key))
+			{
+				return index;
+			}
+		}
+		return invalid_index;
+	}
+
+private:
+	entry m_entries[N];
+	int32_t m_size = 0;
+};
+
+template <typename key_t, typename value_t, typename hasher_t = fhash_constexpr_hash<key_t>, size_t N>
+constexpr fhash_static_table<key_t, value_t, N, hasher_t> make_fhash_static_table(const std::pair<key_t, value_t> (&items)[N])
+{
+	return fhash_static_table<key_t, value_t, N, hasher_t>(items);
+}
+
+// a table of integral keys of at most key_bits bits, storing the quotients of the keys instead of the keys.
+// a key is mixed by an invertible function of key_bits bits, the low bits of the mix select the bucket and only the
+// high bits, the quotient, are stored. the layout is the one of fhash_table, every chain head is in its home slot, so
+// the bucket of any element is the slot of its chain head and the key is recovered from the quotient and the bucket.
+// with 4 byte quotients and values an entry takes 16 bytes, fhash_table<int64_t, int32_t> takes 24.
+// the buckets are at least 2^(key_bits - bits of quotient_t), at most 2^28, so quotient_t defaults to uint64_t for keys
+// of more than 60 bits. the values must be trivially copyable.
+template <typename key_t, typename value_t, int32_t key_bits = int32_t(sizeof(key_t) * 8),
+	typename quotient_t = std::conditional_t<(key_bits - 32 > 28), uint64_t, uint32_t>>
+class fhash_quotient_table
+{
+public:
+	static_assert(std::is_integral<key_t>::value, "key_t must be integral");
+	static_assert(std::is_unsigned<quotient_t>::value, "quotient_t must be unsigned");
+	static_assert(std::is_trivially_copyable<value_t>::value, "value_t must be trivially copyable");
+	static_assert(key_bits >= 16 && key_bits <= 64 && key_bits <= int32_t(sizeof(key_t) * 8), "key_bits must be in [16, bits of key_t]");
+
+	static constexpr int32_t min_bucket_bits = key_bits - int32_t(sizeof(quotient_t) * 8) > 3 ? key_bits - int32_t(sizeof(quotient_t) * 8) : 3;
+	static_assert(min_bucket_bits <= 28, "quotient_t is too small for key_bits");
+
+	const value_t* find(key_t key) const
+	{
+		const int32_t index = find_index(key);
+		return index != invalid_index ? &m_entries[index].value : nullptr;
+	}
+
+	value_t* find(key_t key)
+	{
+		const int32_t index = find_index(key);
+		return index != invalid_index ? &m_entries[index].value : nullptr;
+	}
+
+	// replaces the value if the key exists already, returns the stored value.
+	value_t* insert(key_t key, value_t value)
+	{
+		const int32_t index = find_index(key);
+		if (index != invalid_index)
+		{
+			m_entries[index].value = value;
+			return &m_entries[index].value;
+		}
+		if (m_size == int32_t(m_entries.size()))
+		{
+			rehash(m_entries.empty() ? min_bucket_bits : m_bucket_bits + 1);
+		}
+		const uint64_t h = mix(key);
+		return &m_entries[insert_no_check(get_bucket(h), get_quotient(h), value)].value;
+	}
+
+	bool erase(key_t key)
+	{
+		const int32_t index = find_index(key);
+		if (index == invalid_index)
+		{
+			return false;
+		}
+		entry& e = m_entries[index];
+		if (e.prev != invalid_index)
+		{
+			m_entries[e.prev].next = e.next;
+			if (e.next != invalid_index)
+			{
+				m_entries[e.next].prev = e.prev;
+			}
+			free_entry(index);
+		}
+		else if (e.next != invalid_index)
+		{
+			// the head stays in the home slot, the next element of the same bucket moves into it.
+			const int32_t next_index = e.next;
+			entry& next = m_entries[next_index];
+			e.quotient = next.quotient;
+			e.value = next.value;
+			e.next = next.next;
+			if (next.next != invalid_index)
+			{
+				m_entries[next.next].prev = index;
+			}
+			free_entry(next_index);
+		}
+		else
+		{
+			free_entry(index);
+		}
+		m_size--;
+		return true;
+	}
+
+	void reserve(int32_t expected_size)
+	{
+		int32_t bucket_bits = min_bucket_bits;
+		while (get_entries_size(bucket_bits) < expected_size)
+		{
+			bucket_bits++;
+		}
+		if (m_entries.empty() || bucket_bits > m_bucket_bits)
+		{
+			rehash(bucket_bits);
+		}
+	}
+
+	void clear()
+	{
+		m_entries = std::vector<entry>();
+		m_free_bits = std::vector<uint64_t>();
+		m_free_words = std::vector<uint64_t>();
+		m_bucket_bits = min_bucket_bits;
+		m_size = 0;
+	}
+
+	int32_t size() const
+	{
+		return m_size;
+	}
+
+	// fn(key_t key, const value_t& value), the keys are recovered chain by chain.
+	template <typename function_t>
+	void for_each(function_t fn) const
+	{
+		const int32_t bucket_size = m_entries.empty() ? 0 : int32_t(1) << m_bucket_bits;
+		for (int32_t slot = 0; slot < bucket_size; slot++)
+		{
+			if (m_entries[slot].prev == invalid_index)
+			{
+				for (int32_t index = slot; index != invalid_index; index = m_entries[index].next)
+				{
+					fn(get_key(m_entries[index].quotient, slot), m_entries[index].value);
+				}
+			}
+		}
+	}
+
+	size_t memory_usage() const
+	{
+		return m_entries.capacity() * sizeof(entry) + (m_free_bits.capacity() + m_free_words.capacity()) * sizeof(uint64_t);
+	}
+
+	void validate() const
+	{
+		int32_t size = 0;
+		for (size_t i = 0; i < m_entries.size(); i++)
+		{
+			const entry& e = m_entries[i];
+			assert(((m_free_bits[i / 64] >> (i % 64)) & 1) == (e.prev == free_index ? 1u : 0u));
+			assert(((m_free_words[i / 64 / 64] >> (i / 64 % 64)) & 1) == (m_free_bits[i / 64] != 0 ? 1u : 0u));
+			if (e.prev == free_index)
+			{
+				continue;
+			}
+			size++;
+			if (e.prev == invalid_index)
+			{
+				// every chain member maps back to the bucket of the head.
+				assert(int32_t(i) < (int32_t(1) << m_bucket_bits));
+				for (int32_t index = int32_t(i); index != invalid_index; index = m_entries[index].next)
+				{
+					const uint64_t h = mix(get_key(m_entries[index].quotient, int32_t(i)));
+					assert(get_bucket(h) == int32_t(i) && get_quotient(h) == m_entries[index].quotient);
+					if (m_entries[index].next != invalid_index)
+					{
+						assert(m_entries[m_entries[index].next].prev == index);
+					}
+				}
+			}
+		}
+		assert(size == m_size);
+	}
+
+private:
+	static constexpr int32_t invalid_index = -1;
+	static constexpr int32_t free_index = -2;
+
+	struct entry
+	{
+		// invalid_index for the chain heads, free_index for the unused entries.
+		int32_t prev;
+		int32_t next;
+		quotient_t quotient;
+		value_t value;
+	};
+
+	static constexpr uint64_t key_mask = key_bits == 64 ? ~uint64_t(0) : (uint64_t(1) << (key_bits % 64)) - 1;
+	static constexpr int32_t mix_shift = (key_bits + 1) / 2;
+	static constexpr uint64_t mix_multiplier1 = 0x9E3779B97F4A7C15ull;
+	static constexpr uint64_t mix_multiplier2 = 0xC2B2AE3D27D4EB4Full;
+
+	// the inverse of an odd number modulo 2^64 by newton's iteration, every step doubles the correct low bits.
+	static constexpr uint64_t inverse(uint64_t c)
+	{
+		uint64_t x = c;
+		for (int32_t i = 0; i < 5; i++)
+		{
+			x *= 2 - c * x;
+		}
+		return x;
+	}
+
+	static constexpr uint64_t mix_inverse1 = inverse(mix_multiplier1);
+	static constexpr uint64_t mix_inverse2 = inverse(mix_multiplier2);
+
+	// multiplications by odd numbers and a xorshift of at least half the bits are invertible modulo 2^key_bits.
+	static uint64_t mix(key_t key)
+	{
+		uint64_t h = uint64_t(key);
+		assert((h & ~key_mask) == 0);
+		h = (h * mix_multiplier1) & key_mask;
+		h ^= h >> mix_shift;
+		return (h * mix_multiplier2) & key_mask;
+	}
+
+	static key_t unmix(uint64_t h)
+	{
+		h = (h * mix_inverse2) & key_mask;
+		h ^= h >> mix_shift;
+		return key_t((h * mix_inverse1) & key_mask);
+	}
+
+	key_t get_key(quotient_t quotient, int32_t bucket) const
+	{
+		return unmix((uint64_t(quotient) << m_bucket_bits) | uint64_t(bucket));
+	}
+
+	int32_t get_bucket(uint64_t h) const
+	{
+		return int32_t(h & ((uint64_t(1) << m_bucket_bits) - 1));
+	}
+
+	quotient_t get_quotient(uint64_t h) const
+	{
+		return quotient_t(h >> m_bucket_bits);
+	}
+
+	static int32_t get_entries_size(int32_t bucket_bits)
+	{
+		return (int32_t(1) << bucket_bits) / 2 * 3;
+	}
+
+	int32_t find_index(key_t key) const
+	{
+		if (m_entries.empty())
+		{
+			return invalid_index;
+		}
+		const uint64_t h = mix(key);
+		int32_t index = get_bucket(h);
+		// a free slot or a member of another chain means no chain.
+		if (m_entries[index].prev != invalid_index)
+		{
+			return invalid_index;
+		}
+		const quotient_t quotient = get_quotient(h);
+		for (; index != invalid_index; index = m_entries[index].next)
+		{
+			if (m_entries[index].quotient == quotient)
+			{
+				return index;
+			}
+		}
+		return invalid_index;
+	}
+
+	// the nearest free entry is the nearest set bit in the word of index, or the nearest end of the nearest words with
+	// free entries, which are found by the bits per word.
+	int32_t find_min_distance_free(int32_t index) const
+	{
+		int32_t best = invalid_index;
+		auto consider = [index, &best](int32_t candidate) {
+			if (best == invalid_index || std::abs(candidate - index) < std::abs(best - index))
+			{
+				best = candidate;
+			}
+		};
+		const int32_t word_index = index / 64;
+		const int32_t bit = index % 64;
+		const uint64_t above = m_free_bits[word_index] & (~uint64_t(1) << bit);
+		const uint64_t below = m_free_bits[word_index] & ((uint64_t(1) << bit) - 1);
+		if (above != 0)
+		{
+			consider(word_index * 64 + fhash_lowest_bit(above));
+		}
+		if (below != 0)
+		{
+			consider(word_index * 64 + fhash_highest_bit(below));
+		}
+		const int32_t above_word = find_free_word_above(word_index);
+		if (above_word != invalid_index)
+		{
+			consider(above_word * 64 + fhash_lowest_bit(m_free_bits[above_word]));
+		}
+		const int32_t below_word = find_free_word_below(word_index);
+		if (below_word != invalid_index)
+		{
+			consider(below_word * 64 + fhash_highest_bit(m_free_bits[below_word]));
+		}
+		return best;
+	}
+
+	int32_t find_free_word_above(int32_t word_index) const
+	{
+		const int32_t first = word_index + 1;
+		for (int32_t i = first / 64; i < int32_t(m_free_words.size()); i++)
+		{
+			const uint64_t bits = m_free_words[i] & (i == first / 64 ? ~uint64_t(0) << (first % 64) : ~uint64_t(0));
+			if (bits != 0)
+			{
+				return i * 64 + fhash_lowest_bit(bits);
+			}
+		}
+		return invalid_index;
+	}
+
+	int32_t find_free_word_below(int32_t word_index) const
+	{
+		const int32_t last = word_index - 1;
+		for (int32_t i = last / 64; last >= 0 && i >= 0; i--)
+		{
+			// (2 << 63) - 1 is all the bits.
+			const uint64_t bits = m_free_words[i] & (i == last / 64 ? (uint64_t(2) << (last % 64)) - 1 : ~uint64_t(0));
+			if (bits != 0)
+			{
+				return i * 64 + fhash_highest_bit(bits);
+			}
+		}
+		return invalid_index;
+	}
+
+	void set_free(int32_t index, bool free)
+	{
+		uint64_t& bits = m_free_bits[index / 64];
+		const uint64_t bit = uint64_t(1) << (index % 64);
+		bits = free ? bits | bit : bits & ~bit;
+		uint64_t& words = m_free_words[index / 64 / 64];
+		const uint64_t word_bit = uint64_t(1) << (index / 64 % 64);
+		words = bits != 0 ? words | word_bit : words & ~word_bit;
+	}
+
+	void free_entry(int32_t index)
+	{
+		m_entries[index].prev = free_index;
+		m_entries[index].next = invalid_index;
+		set_free(index, true);
+	}
+
+	int32_t insert_no_check(int32_t slot, quotient_t quotient, value_t value)
+	{
+		entry& e = m_entries[slot];
+		if (e.prev == invalid_index)
+		{
+			// link after the head, the order of a chain doesn't matter.
+			const int32_t index = find_min_distance_free(slot);
+			set_free(index, false);
+			entry& t = m_entries[index];
+			t.prev = slot;
+			t.next = e.next;
+			t.quotient = quotient;
+			t.value = value;
+			if (e.next != invalid_index)
+			{
+				m_entries[e.next].prev = index;
+			}
+			e.next = index;
+			m_size++;
+			return index;
+		}
+		if (e.prev != free_index)
+		{
+			// a member of another chain, it keeps its quotient as it stays in the same chain.
+			const int32_t index = find_min_distance_free(slot);
+			set_free(index, false);
+			m_entries[index] = e;
+			m_entries[e.prev].next = index;
+			if (e.next != invalid_index)
+			{
+				m_entries[e.next].prev = index;
+			}
+		}
+		else
+		{
+			set_free(slot, false);
+		}
+		e.prev = invalid_index;
+		e.next = invalid_index;
+		e.quotient = quotient;
+		e.value = value;
+		m_size++;
+		return slot;
+	}
+
+	void rehash(int32_t bucket_bits)
+	{
+		std::vector<entry> old_entries(get_entries_size(bucket_bits), entry{ free_index, invalid_index, quotient_t(), value_t() });
+		old_entries.swap(m_entries);
+		const int32_t entries_size = int32_t(m_entries.size());
+		// all free, except the bits past the end.
+		m_free_bits.assign((entries_size + 63) / 64, ~uint64_t(0));
+		if (entries_size % 64 != 0)
+		{
+			m_free_bits.back() = (uint64_t(1) << (entries_size % 64)) - 1;
+		}
+		m_free_words.assign((m_free_bits.size() + 63) / 64, ~uint64_t(0));
+		if (m_free_bits.size() % 64 != 0)
+		{
+			m_free_words.back() = (uint64_t(1) << (m_free_bits.size() % 64)) - 1;
+		}
+		const int32_t old_bucket_bits = m_bucket_bits;
+		m_bucket_bits = bucket_bits;
+		m_size = 0;
+		const int32_t old_bucket_size = old_entries.empty() ? 0 : int32_t(1) << old_bucket_bits;
+		for (int32_t slot = 0; slot < old_bucket_size; slot++)
+		{
+			if (old_entries[slot].prev == invalid_index)
+			{
+				for (int32_t index = slot; index != invalid_index; index = old_entries[index].next)
+				{
+					const uint64_t h = mix(unmix((uint64_t(old_entries[index].quotient) << old_bucket_bits) | uint64_t(slot)));
+					insert_no_check(get_bucket(h), get_quotient(h), old_entries[index].value);
+				}
+			}
+		}
+	}
+
+	std::vector<entry> m_entries;
+	// a bit per entry, set for the free ones, and a bit per word of m_free_bits, set if it has a free entry.
+	std::vector<uint64_t> m_free_bits;
+	std::vector<uint64_t> m_free_words;
+	int32_t m_bucket_bits = min_bucket_bits;
+	int32_t m_size = 0;
+};
@@ -1,5 +1,6 @@
 #include "fhash_table.h"
 #include <map>
+#include <list>
 #include <stdlib.h>
 #include <unordered_map>
 #include <iostream>
@@ -7,6 +8,14 @@
 #include <unordered_set>
 #include <chrono>
 #include <cmath>
+#include <string>
+#include <random>
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 template <bool remove_duplicated>
 std::vector<int64_t> gen_random_data(int32_t N)
@@ -32,6 +41,161 @@ std::vector<int64_t> gen_random_data(int32_t N)
 	return data;
 }
 
+struct paged_allocator_policy : fhash_default_allocator_policy
+{
+	static constexpr int32_t cow_page_entries = 64;
+	using stats_t = fhash_runtime_stats;
+};
+
+struct cache_line_aware_allocator_policy : fhash_default_allocator_policy
+{
+	static constexpr bool cache_line_aware_allocation = true;
+};
+
+struct two_choice_allocator_policy : fhash_default_allocator_policy
+{
+	static constexpr bool two_choice = true;
+};
+
+struct bucket_filter_allocator_policy : fhash_default_allocator_policy
+{
+	static constexpr bool bucket_filter = true;
+};
+
+struct paged_bucket_filter_allocator_policy : paged_allocator_policy
+{
+	static constexpr bool bucket_filter = true;
+};
+
+struct two_choice_bucket_filter_allocator_policy : two_choice_allocator_policy
+{
+	static constexpr bool bucket_filter = true;
+};
+
+struct self_organizing_allocator_policy : fhash_default_allocator_policy
+{
+	static constexpr int32_t self_organizing_period = 4;
+};
+
+struct chain_guard_allocator_policy : fhash_default_allocator_policy
+{
+	static constexpr int32_t max_chain_length = 16;
+};
+
+struct fastrange_allocator_policy : fhash_default_allocator_policy
+{
+	static constexpr bool fastrange_buckets = true;
+	static constexpr int32_t growth_factor100 = 125;
+};
+
+struct two_choice_fastrange_allocator_policy : two_choice_allocator_policy
+{
+	static constexpr bool fastrange_buckets = true;
+};
+
+struct huge_page_allocator_policy : fhash_default_allocator_policy
+{
+	using memory_t = fhash_huge_page_memory<true>;
+};
+
+// not derived from fhash_default_allocator_policy, the missing members are its defaults.
+struct standalone_allocator_policy
+{
+	static constexpr int32_t max_chain_length = 8;
+	using stats_t = fhash_runtime_stats;
+};
+
+// built by the compiler, checked by the compiler.
+constexpr std::pair<int32_t, int32_t> static_opcodes[] = { {0x01, 1}, {0x03, 3}, {0x11, 17}, {0x21, 33}, {0x05, 5}, {0x41, 65}, {0x07, 7} };
+static constexpr auto static_opcode_table = make_fhash_static_table(static_opcodes);
+static_assert(static_opcode_table.size() == 7 && static_opcode_table.get(0x41, 0) == 65 && !static_opcode_table.contains(0x02), "");
+// 4 buckets, 0x01, 0x05, 0x11, 0x21, 0x41 share a slot.
+static_assert(static_opcode_table.chain_length(0x01) == 5 && static_opcode_table.chain_length(0x03) == 2, "");
+static constexpr auto static_name_table = make_fhash_static_table<const char*, int32_t>({ {"add", 1}, {"sub", 2}, {"mul", 3}, {"add", 4} });
+static_assert(static_name_table.size() == 3 && static_name_table.get("add", 0) == 4 && static_name_table.get("div", 0) == 0, "");
+
+template <typename value_t, typename to_value_t>
+static void snapshot_test(to_value_t to_value)
+{
+	using fhash_table_t = fhash_table<int64_t, value_t, std::hash<int64_t>, paged_allocator_policy>;
+	std::vector<int64_t> data = gen_random_data<true>(4000);
+	const size_t n = data.size() / 2;
+	std::unique_ptr<fhash_table_t> h(new fhash_table_t());
+	for (size_t i = 0; i < n; i++)
+	{
+		h->insert(data[i], to_value(i));
+	}
+	h->validate();
+
+	const uint64_t allocated = h->get_stats().bytes_allocated;
+	const fhash_table_t s1 = h->snapshot();
+	// only the pages are allocated.
+	assert(h->get_stats().bytes_allocated == allocated);
+	assert(s1.get_stats().bytes_allocated < sizeof(void*) * n);
+
+	for (size_t i = 0; i < n; i++)
+	{
+		if (i % 2 == 0)
+		{
+			h->erase(data[i]);
+		}
+		else
+		{
+			*h->find(data[i]) = to_value(i + 1);
+		}
+	}
+	h->validate();
+	const fhash_table_t s2 = h->snapshot();
+	fhash_table_t s3;
+	s3 = s2;
+	for (size_t i = n; i < data.size(); i++)
+	{
+		h->insert(data[i], to_value(i));
+	}
+	h->validate();
+	const fhash_table_t s4 = h->snapshot();
+	h->erase_if([](int64_t, const value_t&) {return true; });
+	h->validate();
+	h.reset();
+
+	s1.validate();
+	s2.validate();
+	s3.validate();
+	s4.validate();
+	assert(s1.size() == typename fhash_table_t::fhash_size_t(n));
+	assert(s2.size() == typename fhash_table_t::fhash_size_t(n / 2));
+	assert(s3.size() == s2.size());
+	assert(s4.size() == typename fhash_table_t::fhash_size_t(n / 2 + data.size() - n));
+	for (size_t i = 0; i < data.size(); i++)
+	{
+		assert(i < n ? *s1.find(data[i]) == to_value(i) : s1.find(data[i]) == nullptr);
+		if (i < n && i % 2 == 0)
+		{
+			assert(s2.find(data[i]) == nullptr && s4.find(data[i]) == nullptr);
+		}
+		else
+		{
+			assert(i < n ? *s2.find(data[i]) == to_value(i + 1) : s2.find(data[i]) == nullptr);
+			assert(*s4.find(data[i]) == (i < n ? to_value(i + 1) : to_value(i)));
+		}
+	}
+
+	// reading a table which shares its pages doesn't copy them.
+	fhash_table_t reader = s4;
+	const uint64_t shared = reader.get_stats().bytes_allocated;
+	size_t size = 0;
+	for (const auto& r : reader.partition(3))
+	{
+		for (auto it = r.begin(); it != r.end(); ++it)
+		{
+			size++;
+		}
+	}
+	assert(reader.find(data[0]) == nullptr);
+	assert(reader.get_stats().bytes_allocated == shared);
+	assert(size == size_t(s4.size()));
+}
+
 void functional_test()
 {
 	{
@@ -117,95 +281,2545 @@ void functional_test()
 		}
 	}
 
-	// random test.
+	// bulk erase test.
 	{
-		using fhash_table_t = fhash_table<int32_t, int32_t>;
+		using fhash_table_t = fhash_table<int64_t, int64_t>;
 		fhash_table_t h;
-		for (uint32_t j = 0; j < 100; j++)
+		assert(h.erase_if([](int64_t, int64_t) {return true; }) == 0);
+		std::vector<int64_t> data = gen_random_data<true>(10000);
+		for (size_t i = 0; i < data.size(); i++)
 		{
-			const uint32_t N = 1000;
-			for (uint32_t i = 0; i < N; i++)
+			h.insert(data[i], int64_t(i));
+		}
+		const typename fhash_table_t::fhash_size_t erased = h.erase_if([](int64_t, int64_t value) {return value % 3 == 0; });
+		assert(erased == typename fhash_table_t::fhash_size_t((data.size() + 2) / 3));
+		assert(h.size() == typename fhash_table_t::fhash_size_t(data.size()) - erased);
+		h.validate();
+		for (size_t i = 0; i < data.size(); i++)
+		{
+			const int64_t* pi = h.find(data[i]);
+			assert(i % 3 == 0 ? pi == nullptr : *pi == int64_t(i));
+		}
+
+		std::vector<int64_t> keys(data.begin(), data.begin() + data.size() / 2);
+		keys.push_back(-1);
+		const typename fhash_table_t::fhash_size_t erased_keys = h.erase_keys(keys.begin(), keys.end());
+		assert(erased_keys == typename fhash_table_t::fhash_size_t(data.size() / 2 - (data.size() / 2 + 2) / 3));
+		h.validate();
+		for (size_t i = 0; i < data.size(); i++)
+		{
+			const int64_t* pi = h.find(data[i]);
+			assert(i % 3 == 0 || i < data.size() / 2 ? pi == nullptr : *pi == int64_t(i));
+		}
+
+		// the table still works after the free tree is rebuilt.
+		for (size_t i = 0; i < data.size(); i++)
+		{
+			h.insert(data[i], int64_t(i));
+		}
+		h.validate();
+		assert(h.size() == typename fhash_table_t::fhash_size_t(data.size()));
+		assert(h.erase_if([](int64_t, int64_t) {return true; }) == typename fhash_table_t::fhash_size_t(data.size()));
+		assert(h.size() == 0);
+		h.validate();
+	}
+
+	// bulk insert test.
+	{
+		using fhash_table_t = fhash_table<int64_t, int64_t>;
+		fhash_table_t h;
+		std::vector<int64_t> data = gen_random_data<true>(10000);
+		std::vector<std::pair<int64_t, int64_t>> items;
+		for (size_t i = 0; i < data.size() / 2; i++)
+		{
+			items.emplace_back(data[i], int64_t(i));
+		}
+		h.insert_bulk(items.data(), typename fhash_table_t::fhash_size_t(items.size()));
+		h.validate();
+		assert(h.size() == typename fhash_table_t::fhash_size_t(items.size()));
+
+		// existing and duplicated keys, the later one wins.
+		items.clear();
+		for (size_t i = 0; i < data.size(); i++)
+		{
+			items.emplace_back(data[i], -1);
+			items.emplace_back(data[i], int64_t(i));
+		}
+		std::map<int64_t, int64_t> ordered_items(items.begin(), items.end());
+		h.insert(ordered_items.begin(), ordered_items.end());
+		h.validate();
+		h.insert(items.begin(), items.end());
+		h.validate();
+		assert(h.size() == typename fhash_table_t::fhash_size_t(data.size()));
+		for (size_t i = 0; i < data.size(); i++)
+		{
+			assert(*h.find(data[i]) == int64_t(i));
+		}
+
+		// only the new keys are reserved for.
+		const size_t memory = h.memory_usage();
+		std::vector<std::pair<int64_t, int64_t>> existing_items;
+		for (int32_t i = 0; i < 4; i++)
+		{
+			existing_items.insert(existing_items.end(), items.begin(), items.end());
+		}
+		h.insert_bulk(existing_items.data(), typename fhash_table_t::fhash_size_t(existing_items.size()));
+		fhash_table_t copy = h;
+		h.merge(std::move(copy), [](int64_t& value, int64_t&& other_value) {value += other_value; });
+		h.validate();
+		assert(h.memory_usage() == memory && h.size() == typename fhash_table_t::fhash_size_t(data.size()));
+		for (size_t i = 0; i < data.size(); i++)
+		{
+			assert(*h.find(data[i]) == int64_t(i) * 2);
+		}
+	}
+
+	// upsert batch test.
+	{
+		using fhash_table_t = fhash_table<int64_t, int64_t>;
+		std::vector<int64_t> keys;
+		std::vector<int64_t> values;
+		for (int64_t i = 0; i < 20000; i++)
+		{
+			// repeated keys, and within the same batch every 5th.
+			keys.push_back(i % 5 == 4 ? keys[size_t(i - 2)] : (i * 7919) % 3001);
+			values.push_back(i);
+		}
+		std::unordered_map<int64_t, int64_t> expected;
+		for (size_t i = 0; i < keys.size(); i++)
+		{
+			expected[keys[i]] += values[i];
+		}
+		auto add = [](int64_t& value, const int64_t& new_value) {value += new_value; };
+
+		fhash_table_t h;
+		h.insert(keys[0], 0);
+		h.upsert_batch(keys.data(), values.data(), typename fhash_table_t::fhash_size_t(keys.size()), add);
+		h.validate();
+		assert(h.size() == typename fhash_table_t::fhash_size_t(expected.size()));
+		for (const auto& kv : expected)
+		{
+			assert(*h.find(kv.first) == kv.second);
+		}
+
+		fhash_table<int64_t, int64_t, std::hash<int64_t>, two_choice_allocator_policy> two_choice;
+		two_choice.upsert_batch(keys.data(), values.data(), 7, add);
+		two_choice.upsert_batch(keys.data() + 7, values.data() + 7, typename fhash_table_t::fhash_size_t(keys.size() - 7), add);
+		two_choice.validate();
+		for (const auto& kv : expected)
+		{
+			assert(*two_choice.find(kv.first) == kv.second);
+		}
+
+		// the values of a key repeated within a batch are combined in their order.
+		const std::vector<int64_t> repeated_keys = { 1, 2, 1, 1, 3, 2, 1 };
+		const std::vector<int64_t> digits = { 1, 2, 3, 4, 5, 6, 7 };
+		fhash_table_t ordered;
+		ordered.upsert_batch(repeated_keys.data(), digits.data(), typename fhash_table_t::fhash_size_t(repeated_keys.size()),
+			[](int64_t& value, const int64_t& new_value) {value = value * 10 + new_value; });
+		ordered.validate();
+		assert(ordered.size() == 3 && *ordered.find(1) == 1347 && *ordered.find(2) == 26 && *ordered.find(3) == 5);
+	}
+
+	// merge and node handle test, the values are move only.
+	{
+		using fhash_table_t = fhash_table<int64_t, std::unique_ptr<int64_t>>;
+		std::vector<int64_t> data = gen_random_data<true>(3000);
+		fhash_table_t a;
+		fhash_table_t b;
+		for (size_t i = 0; i < data.size(); i++)
+		{
+			if (i < 2000)
 			{
-				h.insert(rand(), i);
+				a.insert(data[i], std::unique_ptr<int64_t>(new int64_t(1)));
 			}
+			if (i >= 1000)
+			{
+				b.insert(data[i], std::unique_ptr<int64_t>(new int64_t(2)));
+			}
+		}
+		a.merge(std::move(b), [](std::unique_ptr<int64_t>& value, std::unique_ptr<int64_t>&& other_value) {*value += *other_value; });
+		a.validate();
+		b.validate();
+		assert(b.size() == 0);
+		assert(a.size() == typename fhash_table_t::fhash_size_t(data.size()));
+		for (size_t i = 0; i < data.size(); i++)
+		{
+			assert(**a.find(data[i]) == (i < 1000 ? 1 : i < 2000 ? 3 : 2));
+		}
 
-			uint32_t deleted = 0;
-			typename fhash_table_t::fhash_size_t total = h.size();
-			for (uint32_t k = 0; k < 10; k++)
+		fhash_table_t c;
+		c.merge(std::move(a));
+		assert(a.size() == 0);
+		assert(c.size() == typename fhash_table_t::fhash_size_t(data.size()));
+
+		for (size_t i = 0; i < data.size(); i += 2)
+		{
+			typename fhash_table_t::node_type node = c.extract(data[i]);
+			assert(!node.empty());
+			assert(node.key() == data[i]);
+			assert(c.find(data[i]) == nullptr);
+			a.insert(std::move(node));
+			assert(node.empty());
+		}
+		assert(c.extract(data[0]).empty());
+		a.validate();
+		c.validate();
+		assert(a.size() + c.size() == typename fhash_table_t::fhash_size_t(data.size()));
+		for (size_t i = 0; i < data.size(); i++)
+		{
+			assert((i % 2 == 0 ? a : c).find(data[i]) != nullptr);
+		}
+	}
+
+	// copy test.
+	{
+		using fhash_table_t = fhash_table<int64_t, int64_t>;
+		using fhash_string_table_t = fhash_table<int64_t, std::string>;
+		static_assert(fhash_table_t::is_trivially_copyable_data, "int64_t table should be copied with memcpy");
+		static_assert(!fhash_string_table_t::is_trivially_copyable_data, "std::string table shouldn't be copied with memcpy");
+		std::vector<int64_t> data = gen_random_data<true>(1000);
+		fhash_table_t h;
+		fhash_string_table_t hs;
+		for (size_t i = 0; i < data.size(); i++)
+		{
+			h.insert(data[i], int64_t(i));
+			hs.insert(data[i], std::to_string(i));
+		}
+		fhash_table_t h2 = h;
+		fhash_string_table_t hs2 = hs;
+		h2.validate();
+		hs2.validate();
+		h.erase(data[0]);
+		h2 = h;
+		h2.validate();
+		h2 = h2;
+		h2.validate();
+		hs2 = hs;
+		hs2.validate();
+		assert(h2.size() == h.size() && hs2.size() == hs.size());
+		for (size_t i = 0; i < data.size(); i++)
+		{
+			assert(i == 0 ? h2.find(data[i]) == nullptr : *h2.find(data[i]) == int64_t(i));
+			assert(*hs2.find(data[i]) == std::to_string(i));
+		}
+		h2.clear();
+		hs2.clear();
+		h2.validate();
+		hs2.validate();
+
+		// an empty table assigned to an allocated one of the same entries size.
+		fhash_table_t empty;
+		fhash_table_t a;
+		a.set_load_parameters(200);
+		a.insert(1, 1);
+		a = empty;
+		a.validate();
+		assert(a.size() == 0 && a.find(1) == nullptr);
+		a.insert(2, 2);
+		a.validate();
+		assert(*a.find(2) == 2);
+	}
+
+	// precomputed hash test.
+	{
+		using fhash_table_t = fhash_table<int64_t, int64_t>;
+		struct other_hasher : std::hash<int64_t> {};
+		static_assert(!std::is_convertible<fhash_table_t::precomputed_hash_t, fhash_table<int64_t, int64_t, other_hasher>::precomputed_hash_t>::value,
+			"hashes of different hashers shouldn't be mixed");
+		std::vector<int64_t> data = gen_random_data<true>(1000);
+		std::vector<fhash_table_t> tables(10);
+		for (size_t i = 0; i < data.size(); i++)
+		{
+			const fhash_table_t::precomputed_hash_t hash = tables[0].hash_of(data[i]);
+			for (fhash_table_t& h : tables)
 			{
-				for (auto it = h.begin(); it < h.end();)
+				h.insert(data[i], int64_t(i), hash);
+			}
+		}
+		for (size_t i = 0; i < data.size(); i++)
+		{
+			const fhash_table_t::precomputed_hash_t hash = tables[0].hash_of(data[i]);
+			for (fhash_table_t& h : tables)
+			{
+				h.prefetch(hash);
+			}
+			for (fhash_table_t& h : tables)
+			{
+				assert(*h.find(data[i], hash) == int64_t(i));
+				assert(h.find(data[i]) == h.find(data[i], hash));
+			}
+			if (i % 2 == 0)
+			{
+				for (fhash_table_t& h : tables)
 				{
-					if (rand() & 1)
-					{
-						it = h.erase(it);
-						deleted++;
-					}
-					else
-					{
-						it++;
-					}
+					h.erase(data[i], hash);
+					assert(h.find(data[i], hash) == nullptr);
 				}
 			}
-			assert(total == h.size() + deleted);
+		}
+		for (fhash_table_t& h : tables)
+		{
+			h.validate();
+			assert(h.size() == typename fhash_table_t::fhash_size_t(data.size() / 2));
 		}
 	}
-}
 
-static void test_find_success()
-{
-	for (int32_t i = 1; i < 15; i++)
+	// partition test.
 	{
-		const int32_t N = int32_t(std::pow(3, i));
-		std::cout << "N = " << N << std::endl;
-		std::vector<int64_t> data = gen_random_data<true>(N);
+		using fhash_table_t = fhash_table<int64_t, int64_t>;
+		fhash_table_t h;
+		assert(h.partition(4).size() == 4);
+		h.parallel_for_each([](int64_t, int64_t&) {assert(false); }, 4);
+		std::vector<int64_t> data = gen_random_data<true>(10000);
+		for (size_t i = 0; i < data.size(); i++)
+		{
+			h.insert(data[i], int64_t(i));
+		}
+		for (int32_t count : {1, 3, 7, 64, 100000})
 		{
-			fhash_table<int64_t, int64_t> m;
-			for (int64_t i : data)
-			{
-				m.insert(i, i);
-			}
-			std::vector<int64_t> shuffled_data = data;
-			std::random_shuffle(shuffled_data.begin(), shuffled_data.end());
-			auto start = std::chrono::high_resolution_clock::now();
 			int64_t sum = 0;
-			for (int32_t i = 0; i < 100000000 / N; i++)
+			size_t size = 0;
+			const fhash_table_t& ch = h;
+			for (auto& r : ch.partition(count))
 			{
-				for (int64_t i : shuffled_data)
+				for (auto&& pr : r)
 				{
-					sum += *m.find(i);
+					sum += pr.second;
+					size++;
 				}
 			}
-			auto end = std::chrono::high_resolution_clock::now();
-			auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
-			std::cout << "fhash_table, elapsed milliseconds: " << elapsed << " sum: " << sum << " load_factor: " << m.load_factor() << std::endl;
+			assert(size == data.size());
+			assert(sum == int64_t(data.size() * (data.size() - 1) / 2));
 		}
+		h.parallel_for_each([](int64_t key, int64_t& value) {value = key; }, 4);
+		for (size_t i = 0; i < data.size(); i++)
 		{
-			std::unordered_map<int64_t, int64_t> m;
-			for (int64_t i : data)
+			assert(*h.find(data[i]) == data[i]);
+		}
+
+		// the threads write the pages shared with a snapshot.
+		using paged_table_t = fhash_table<int64_t, int64_t, std::hash<int64_t>, paged_allocator_policy>;
+		paged_table_t paged;
+		for (size_t i = 0; i < data.size(); i++)
+		{
+			paged.insert(data[i], int64_t(i));
+		}
+		const paged_table_t snapshot = paged.snapshot();
+		paged.parallel_for_each([](int64_t, int64_t& value) {value++; }, 4);
+		paged.validate();
+		snapshot.validate();
+		for (size_t i = 0; i < data.size(); i++)
+		{
+			assert(*paged.find(data[i]) == int64_t(i) + 1 && *snapshot.find(data[i]) == int64_t(i));
+		}
+	}
+
+	// copy on write snapshot test.
+	{
+		snapshot_test<int64_t>([](size_t i) {return int64_t(i); });
+		snapshot_test<std::string>([](size_t i) {return std::to_string(i); });
+	}
+
+	// huge page memory test.
+	{
+		using fhash_table_t = fhash_table<int64_t, int64_t, std::hash<int64_t>, huge_page_allocator_policy>;
+		fhash_table_t h;
+		// grows from malloc through mmap sizes.
+		std::vector<int64_t> data = gen_random_data<true>(200000);
+		for (int64_t i : data)
+		{
+			h.insert(i, i);
+		}
+		h.validate();
+		fhash_table_t copy = h;
+		for (int64_t i : data)
+		{
+			assert(*copy.find(i) == i);
+		}
+		h.clear();
+		assert(h.size() == 0 && copy.size() == typename fhash_table_t::fhash_size_t(data.size()));
+	}
+
+	// load parameters test.
+	{
+		using fhash_table_t = fhash_table<int64_t, int64_t>;
+		std::vector<int64_t> data = gen_random_data<true>(20000);
+		fhash_table_t dense;
+		fhash_table_t sparse;
+		fhash_table_t fast_growing;
+		sparse.insert(data[0], data[0]);
+		dense.set_load_parameters(400);
+		sparse.set_load_parameters(100);
+		fast_growing.set_load_parameters(fast_growing.get_elements_per_bucket100(), 800);
+		int32_t fast_growing_rehashes = 0;
+		int32_t default_rehashes = 0;
+		fhash_table_t default_table;
+		for (int64_t i : data)
+		{
+			for (fhash_table_t* h : {&dense, &sparse})
 			{
-				m.emplace(i, i);
+				h->insert(i, i);
 			}
-			std::vector<int64_t> shuffled_data = data;
-			std::random_shuffle(shuffled_data.begin(), shuffled_data.end());
-			int64_t sum = 0;
-			auto start = std::chrono::high_resolution_clock::now();
-			for (int32_t i = 0; i < 100000000 / N; i++)
+			const int32_t capacity = fast_growing.capacity();
+			fast_growing.insert(i, i);
+			fast_growing_rehashes += capacity != fast_growing.capacity();
+			const int32_t default_capacity = default_table.capacity();
+			default_table.insert(i, i);
+			default_rehashes += default_capacity != default_table.capacity();
+		}
+		assert(fast_growing_rehashes < default_rehashes);
+		assert(dense.load_factor() > default_table.load_factor() && default_table.load_factor() > sparse.load_factor());
+		assert(sparse.memory_usage() >= data.size() * sizeof(std::pair<int64_t, int64_t>));
+		fhash_table_t copy = dense;
+		assert(copy.get_elements_per_bucket100() == 400 && copy.memory_usage() == dense.memory_usage());
+		for (fhash_table_t* h : {&dense, &sparse, &fast_growing, &copy})
+		{
+			h->validate();
+			for (int64_t i : data)
 			{
-				for (int64_t i : shuffled_data)
-				{
-					sum += m.find(i)->second;
-				}
+				assert(*h->find(i) == i);
 			}
-			auto end = std::chrono::high_resolution_clock::now();
-			auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
-			std::cout << "std::unordered_map, elapsed milliseconds: " << elapsed << " sum: " << sum << std::endl;
 		}
+		// applies to an allocated table by rehashing.
+		dense.set_load_parameters(100);
+		dense.validate();
+		assert(dense.load_factor() < copy.load_factor() && dense.size() == copy.size());
+		assert(fhash_table_t().memory_usage() == 0);
+	}
+
+	// cache line aware allocation test.
+	{
+		using fhash_table_t = fhash_table<int64_t, int64_t, std::hash<int64_t>, cache_line_aware_allocator_policy>;
+		fhash_table_t h;
+		std::vector<int64_t> data = gen_random_data<true>(5000);
+		for (size_t i = 0; i < data.size(); i++)
+		{
+			h.insert(data[i], int64_t(i));
+			if (i % 3 == 0)
+			{
+				h.erase(data[i / 2]);
+			}
+		}
+		h.validate();
+		std::vector<fhash_table_t::fhash_size_t> cache_lines = h.get_chain_cache_line_stats();
+		assert(cache_lines.size() > 1 && cache_lines[0] == 0);
+		int32_t chains = 0;
+		for (auto count : cache_lines)
+		{
+			chains += count;
+		}
+		assert(chains > 0 && chains <= h.size());
+		for (auto it = h.begin(); it; ++it)
+		{
+			assert(*h.find(it.key()) == it.value());
+		}
+	}
+
+	// two choice test.
+	{
+		using fhash_table_t = fhash_table<int64_t, int64_t, std::hash<int64_t>, two_choice_allocator_policy>;
+		fhash_table_t h;
+		std::vector<int64_t> data = gen_random_data<true>(5000);
+		for (size_t i = 0; i < data.size(); i++)
+		{
+			h.insert(data[i], int64_t(i));
+			if (i % 3 == 0)
+			{
+				h.erase(data[i / 2]);
+			}
+		}
+		h.validate();
+		for (auto it = h.begin(); it; ++it)
+		{
+			assert(*h.find(it.key()) == it.value());
+		}
+		for (size_t i = 0; i < data.size(); i++)
+		{
+			const int64_t* value = h.find(data[i]);
+			assert(!value || *value == int64_t(i));
+		}
+
+		// keys colliding in the home slot spread over their second slots.
+		fhash_table_t adversarial;
+		fhash_table<int64_t, int64_t> single;
+		for (int64_t i = 0; i < 1000; i++)
+		{
+			adversarial.insert(i << 10, i);
+			single.insert(i << 10, i);
+		}
+		adversarial.validate();
+		assert(adversarial.get_chain_length_stats().size() < single.get_chain_length_stats().size());
+		for (int64_t i = 0; i < 1000; i++)
+		{
+			assert(*adversarial.find(i << 10) == i);
+		}
+		for (int64_t i = 0; i < 1000; i += 2)
+		{
+			assert(adversarial.erase(i << 10));
+		}
+		adversarial.validate();
+		fhash_table_t copy = adversarial;
+		copy.validate();
+		assert(copy.size() == 500 && *copy.find(1 << 10) == 1 && !copy.find(2 << 10));
+	}
+
+	// bucket filter test.
+	{
+		auto test = [](auto h)
+		{
+			using fhash_table_t = decltype(h);
+			std::vector<int64_t> data = gen_random_data<true>(6000);
+			std::unordered_map<int64_t, int64_t> expected;
+			for (size_t i = 0; i < data.size() / 2; i++)
+			{
+				h.insert(data[i], int64_t(i));
+				expected[data[i]] = int64_t(i);
+				if (i % 3 == 0)
+				{
+					h.erase(data[i / 2]);
+					expected.erase(data[i / 2]);
+				}
+			}
+			h.validate();
+			fhash_table_t copy = h;
+			fhash_table_t moved = std::move(copy);
+			h.insert(data.back(), -1);
+			for (const fhash_table_t* t : { &h, &moved })
+			{
+				for (const auto& kv : expected)
+				{
+					assert(*t->find(kv.first) == kv.second);
+				}
+				// the other half is never inserted, the last key only into h.
+				for (size_t i = data.size() / 2; i + 1 < data.size(); i++)
+				{
+					assert(!t->find(data[i]));
+				}
+			}
+			assert(*h.find(data.back()) == -1 && !moved.find(data.back()));
+			for (const auto& kv : expected)
+			{
+				moved.erase(kv.first);
+			}
+			assert(moved.size() == 0 && !moved.find(data[0]));
+			moved.clear();
+			assert(moved.memory_usage() == 0 && !moved.find(data[0]));
+		};
+		test(fhash_table<int64_t, int64_t, std::hash<int64_t>, bucket_filter_allocator_policy>());
+		test(fhash_table<int64_t, int64_t, std::hash<int64_t>, paged_bucket_filter_allocator_policy>());
+		test(fhash_table<int64_t, int64_t, std::hash<int64_t>, two_choice_bucket_filter_allocator_policy>());
+
+		fhash_table<int64_t, int64_t> h;
+		fhash_table<int64_t, int64_t, std::hash<int64_t>, bucket_filter_allocator_policy> filtered;
+		for (int64_t i = 0; i < 1000; i++)
+		{
+			h.insert(i, i);
+			filtered.insert(i, i);
+		}
+		// one byte per bucket.
+		assert(filtered.memory_usage() == h.memory_usage() + size_t(std::lround(filtered.size() / filtered.load_factor())));
+
+		// erase_if empties every chain and clears its filter byte, so the finds miss without touching the entries.
+		struct traced_bucket_filter_allocator_policy : bucket_filter_allocator_policy
+		{
+			using stats_t = fhash_cache_line_tracer;
+		};
+		fhash_table<int64_t, int64_t, std::hash<int64_t>, traced_bucket_filter_allocator_policy> traced;
+		for (int64_t i = 0; i < 1000; i++)
+		{
+			traced.insert(i, i);
+		}
+		assert(traced.erase_if([](int64_t, int64_t) {return true; }) == 1000);
+		traced.reset_stats();
+		for (int64_t i = 0; i < 1000; i++)
+		{
+			assert(!traced.find(i));
+		}
+		assert(traced.get_stats().average_cache_lines(fhash_operation::find) == 0);
+		for (int64_t i = 0; i < 1000; i++)
+		{
+			traced.insert(i, i);
+		}
+		traced.validate();
+		assert(*traced.find(999) == 999);
+	}
+
+	// self organizing chains test.
+	{
+		using fhash_table_t = fhash_table<int64_t, std::string, std::hash<int64_t>, self_organizing_allocator_policy>;
+		fhash_table_t h;
+		// the keys share the home slot 0 of 1024 buckets.
+		for (int64_t i = 0; i < 600; i++)
+		{
+			h.insert(i << 10, std::to_string(i));
+		}
+		const int64_t hot_key = 599 << 10;
+		std::vector<fhash_table_t::fhash_size_t> lengths = h.get_chain_length_stats();
+		assert(lengths.size() == 601 && lengths[600] == 1);
+		for (int32_t i = 0; i < 600 * 4; i++)
+		{
+			assert(*h.find(hot_key) == "599");
+		}
+		h.validate();
+		assert(h.iterator_at(0).key() == hot_key);
+		for (int64_t i = 0; i < 600; i++)
+		{
+			assert(*h.find(i << 10) == std::to_string(i));
+		}
+
+		// the const find never moves elements.
+		const fhash_table_t& const_h = h;
+		const int64_t head_key = h.iterator_at(0).key();
+		for (int64_t i = 0; i < 600 * 4; i++)
+		{
+			assert(*const_h.find((i % 600) << 10) == std::to_string(i % 600));
+		}
+		assert(h.iterator_at(0).key() == head_key);
+	}
+
+	// hash flooding test.
+	{
+		using fhash_table_t = fhash_table<int64_t, int64_t, std::hash<int64_t>, chain_guard_allocator_policy>;
+		// the identity hash of the keys differs only above the bucket bits, or above 32 bits.
+		for (const int shift : { 20, 40, 48 })
+		{
+			fhash_table_t h;
+			for (int64_t i = 0; i < 20000; i++)
+			{
+				auto it = h.insert(i << shift, i);
+				assert(it.key() == (i << shift) && it.value() == i);
+			}
+			h.validate();
+			assert(h.get_chain_length_stats().size() <= 17);
+			for (int64_t i = 0; i < 20000; i++)
+			{
+				assert(*h.find(i << shift) == i);
+			}
+			for (int64_t i = 0; i < 20000; i += 2)
+			{
+				h.erase(i << shift);
+			}
+			const fhash_table_t copy = h;
+			copy.validate();
+			assert(copy.size() == 10000 && *copy.find(int64_t(1) << shift) == 1 && !copy.find(int64_t(2) << shift));
+		}
+
+		// the guard runs within the bulk operations.
+		for (const int shift : { 24, 40, 48 })
+		{
+			std::vector<std::pair<int64_t, int64_t>> items;
+			std::vector<int64_t> keys;
+			for (int64_t i = 0; i < 5000; i++)
+			{
+				items.emplace_back(i << shift, i);
+				keys.push_back(i << shift);
+			}
+			// a repeated key keeps the last value.
+			items.emplace_back(int64_t(7) << shift, -7);
+			fhash_table_t bulk;
+			bulk.insert_bulk(items.data(), typename fhash_table_t::fhash_size_t(items.size()));
+			bulk.validate();
+			assert(bulk.size() == 5000 && bulk.get_chain_length_stats().size() <= 17);
+			assert(*bulk.find(int64_t(7) << shift) == -7 && *bulk.find(int64_t(8) << shift) == 8);
+			fhash_table_t merged;
+			merged.insert(-1, -1);
+			merged.merge(std::move(bulk));
+			merged.validate();
+			assert(merged.size() == 5001 && merged.get_chain_length_stats().size() <= 17);
+			fhash_table_t upserted;
+			upserted.upsert_batch(keys.data(), keys.data(), typename fhash_table_t::fhash_size_t(keys.size()),
+				[](int64_t& value, int64_t new_value) {value += new_value; });
+			upserted.validate();
+			assert(upserted.size() == 5000 && upserted.get_chain_length_stats().size() <= 17);
+			assert(*upserted.find(int64_t(9) << shift) == int64_t(9) << shift);
+		}
+
+		// equal hashes can't be separated, the reseeds are limited to one per doubling of the size.
+		struct constant_hasher
+		{
+			size_t operator()(int64_t) const
+			{
+				return 42;
+			}
+		};
+		fhash_table<int64_t, int64_t, constant_hasher, chain_guard_allocator_policy> flooded;
+		for (int64_t i = 0; i < 2000; i++)
+		{
+			flooded.insert(i, i);
+		}
+		flooded.validate();
+		assert(flooded.get_chain_length_stats().size() == 2001);
+		for (int64_t i = 0; i < 2000; i++)
+		{
+			assert(*flooded.find(i) == i);
+		}
+	}
+
+	// quotient table test.
+	{
+		auto test = [](auto h, int64_t key_mask)
+		{
+			std::mt19937_64 random(7);
+			std::unordered_map<int64_t, int32_t> expected;
+			for (int32_t i = 0; i < 20000; i++)
+			{
+				const int64_t key = int64_t(random() & uint64_t(key_mask));
+				*h.insert(key, i) += 1;
+				expected[key] = i + 1;
+				if (i % 3 == 0)
+				{
+					const int64_t erased = int64_t(random() & uint64_t(key_mask)) % 64;
+					assert(h.erase(erased) == (expected.erase(erased) > 0));
+				}
+				// small keys collide with the erased ones.
+				if (i % 5 == 0)
+				{
+					h.insert(i % 64, i);
+					expected[i % 64] = i;
+				}
+			}
+			h.validate();
+			assert(h.size() == int32_t(expected.size()));
+			for (const auto& kv : expected)
+			{
+				assert(*h.find(kv.first) == kv.second);
+			}
+			assert(!h.find(key_mask) || expected.count(key_mask));
+			size_t visited = 0;
+			h.for_each([&](int64_t key, int32_t value) {
+				assert(expected.at(key) == value);
+				visited++;
+			});
+			assert(visited == expected.size());
+			h.clear();
+			assert(h.size() == 0 && !h.find(1) && h.memory_usage() == 0);
+		};
+		test(fhash_quotient_table<int64_t, int32_t, 40>(), (int64_t(1) << 40) - 1);
+		test(fhash_quotient_table<int64_t, int32_t, 20, uint16_t>(), (int64_t(1) << 20) - 1);
+		// full 64 bit keys default to 8 byte quotients.
+		test(fhash_quotient_table<int64_t, int32_t>(), -1);
+
+		// 40 bit keys take 16 bytes per entry, 64 bit keys 24, plus a bit per entry for the free entries.
+		fhash_quotient_table<int64_t, int32_t, 40> compressed;
+		fhash_table<int64_t, int32_t> plain;
+		compressed.reserve(10000);
+		plain.reserve(10000);
+		assert(compressed.memory_usage() * 4 < plain.memory_usage() * 3);
+	}
+
+	// fastrange buckets test.
+	{
+		using fhash_table_t = fhash_table<int64_t, int64_t, std::hash<int64_t>, fastrange_allocator_policy>;
+		fhash_table_t h;
+		std::vector<int64_t> data = gen_random_data<true>(10000);
+		for (size_t i = 0; i < data.size(); i++)
+		{
+			h.insert(data[i], int64_t(i));
+			if (i % 3 == 0)
+			{
+				h.erase(data[i / 2]);
+			}
+		}
+		h.validate();
+		for (size_t i = 0; i < data.size(); i++)
+		{
+			const int64_t* value = h.find(data[i]);
+			assert(!value || *value == int64_t(i));
+		}
+
+		// the buckets follow the expected size instead of the next power of 2, 1074 buckets instead of 2048.
+		fhash_table_t exact;
+		fhash_table<int64_t, int64_t> rounded;
+		exact.reserve(1600);
+		rounded.reserve(1600);
+		assert(exact.memory_usage() * 3 < rounded.memory_usage() * 2);
+		// sequential keys spread.
+		for (int64_t i = 0; i < 1100; i++)
+		{
+			exact.insert(i, i);
+		}
+		exact.validate();
+		assert(exact.get_chain_length_stats().size() < 10);
+		fhash_table<int64_t, int64_t, std::hash<int64_t>, two_choice_fastrange_allocator_policy> two_choice;
+		for (int64_t i = 0; i < 1100; i++)
+		{
+			two_choice.insert(i << 16, i);
+		}
+		two_choice.validate();
+		for (int64_t i = 0; i < 1100; i++)
+		{
+			assert(*two_choice.find(i << 16) == i);
+		}
+	}
+
+	// cache test.
+	{
+		fhash_cache<int64_t, int64_t> cache(100);
+		assert(cache.find(0) == nullptr);
+		for (int64_t i = 0; i < 1000; i++)
+		{
+			cache.insert(i, i);
+			// the hot keys are referenced before every insert, CLOCK keeps them.
+			for (int64_t hot = 0; hot < 10 && hot <= i; hot++)
+			{
+				assert(*cache.find(hot) == hot);
+			}
+			assert(cache.size() <= cache.capacity());
+		}
+		cache.validate();
+		assert(cache.size() == 100 && cache.get_evictions() == 900);
+		assert(*cache.find(999) == 999);
+		assert(cache.insert(999, 1) == 1 && *cache.find(999) == 1);
+		assert(cache.erase(999) && !cache.erase(999) && cache.size() == 99);
+		cache.clear();
+		assert(cache.size() == 0 && cache.find(0) == nullptr);
+
+		fhash_cache<int64_t, std::string, true> ttl_cache(10, std::chrono::hours(1));
+		ttl_cache.insert(1, "1");
+		ttl_cache.insert(2, "2", std::chrono::seconds(0));
+		assert(*ttl_cache.find(1) == "1");
+		assert(ttl_cache.find(2) == nullptr && ttl_cache.size() == 1);
+		for (int64_t i = 0; i < 100; i++)
+		{
+			ttl_cache.insert(i, std::to_string(i), i % 2 ? std::chrono::seconds(0) : std::chrono::hours(1));
+		}
+		ttl_cache.validate();
+		assert(ttl_cache.size() <= 10 && ttl_cache.find(99) == nullptr);
+		ttl_cache.insert(100, "100");
+		assert(*ttl_cache.find(100) == "100");
+	}
+
+	// static table test.
+	{
+		const size_t N = 1000;
+		std::vector<int64_t> data = gen_random_data<true>(N);
+		std::pair<int64_t, int64_t> items[N];
+		for (size_t i = 0; i < N; i++)
+		{
+			items[i] = std::make_pair(data[i], int64_t(i));
+		}
+		const fhash_static_table<int64_t, int64_t, N> h(items);
+		assert(h.size() == int32_t(N));
+		for (size_t i = 0; i < N; i++)
+		{
+			assert(*h.find(data[i]) == int64_t(i));
+			assert(h.find(data[i] + 1) == nullptr || *h.find(data[i] + 1) != int64_t(i));
+		}
+		assert(*static_opcode_table.find(0x11) == 17 && *static_name_table.find("sub") == 2);
+	}
+
+	// segmented table test.
+	{
+		using fhash_segmented_table_t = fhash_segmented_table<int64_t, int64_t, 4>;
+		fhash_segmented_table_t h;
+		assert(h.find(0) == nullptr && !h.erase(0));
+		std::vector<int64_t> data = gen_random_data<true>(100000);
+		h.reserve(data.size() / 2);
+		for (int64_t i : data)
+		{
+			assert(h.insert(i, i).value() == i);
+		}
+		assert(h.size() == data.size());
+		for (size_t i = 0; i < fhash_segmented_table_t::segment_count; i++)
+		{
+			assert(h.segment(i).size() > 0);
+		}
+		for (size_t i = 0; i < data.size(); i += 2)
+		{
+			assert(h.erase(data[i]));
+			assert(!h.erase(data[i]));
+		}
+		h.validate();
+		uint64_t sum = 0;
+		size_t size = 0;
+		h.for_each([&](int64_t key, int64_t& value) {assert(key == value); sum += uint64_t(value); size++; });
+		uint64_t expected_sum = 0;
+		for (size_t i = 0; i < data.size(); i++)
+		{
+			const int64_t* value = h.find(data[i]);
+			assert((i % 2 == 0) == (value == nullptr));
+			if (value)
+			{
+				expected_sum += uint64_t(*value);
+			}
+		}
+		assert(size == h.size() && sum == expected_sum);
+		h.clear();
+		assert(h.size() == 0 && h.find(data[1]) == nullptr);
+	}
+
+	// dense map test.
+	{
+		using fhash_dense_map_t = fhash_dense_map<int64_t, std::string>;
+		fhash_dense_map_t h;
+		assert(h.find(0) == nullptr && !h.erase(0));
+		std::vector<int64_t> data = gen_random_data<true>(10000);
+		for (size_t i = 0; i < data.size(); i++)
+		{
+			assert(h.insert(data[i], std::to_string(data[i]))->first == data[i]);
+		}
+		h.validate();
+		// iterates in insertion order.
+		for (size_t i = 0; i < data.size(); i++)
+		{
+			assert(h.data()[i].first == data[i]);
+		}
+		h.insert(data[0], "replaced");
+		assert(h.size() == int32_t(data.size()) && *h.find(data[0]) == "replaced");
+		for (size_t i = 0; i < data.size(); i += 3)
+		{
+			assert(h.erase(data[i]));
+			assert(!h.erase(data[i]));
+		}
+		h.validate();
+		fhash_dense_map_t copy = h;
+		fhash_dense_map_t moved = std::move(h);
+		assert(h.size() == 0 && h.find(data[1]) == nullptr);
+		for (fhash_dense_map_t* m : {&copy, &moved})
+		{
+			m->validate();
+			size_t size = 0;
+			for (auto& pr : *m)
+			{
+				assert(pr.second == std::to_string(pr.first));
+				size++;
+			}
+			assert(size == size_t(m->size()));
+			for (size_t i = 0; i < data.size(); i++)
+			{
+				assert((m->find(data[i]) == nullptr) == (i % 3 == 0));
+			}
+			// the index keeps working after moving, i.e. rehash hashes the right keys.
+			for (size_t i = 0; i < data.size(); i += 3)
+			{
+				m->insert(data[i], std::to_string(data[i]));
+			}
+			m->validate();
+		}
+		h = copy;
+		h.validate();
+		h.clear();
+		assert(h.size() == 0 && copy.size() == int32_t(data.size()));
+	}
+
+	// stats test.
+	{
+		struct stats_allocator_policy : fhash_default_allocator_policy
+		{
+			using stats_t = fhash_runtime_stats;
+		};
+		using fhash_table_t = fhash_table<int64_t, int64_t, std::hash<int64_t>, stats_allocator_policy>;
+		fhash_table_t h;
+		std::vector<int64_t> data = gen_random_data<true>(1000);
+		for (size_t i = 0; i < data.size(); i++)
+		{
+			h.insert(data[i], int64_t(i));
+		}
+		const fhash_runtime_stats& stats = h.get_stats();
+		assert(stats.inserts == data.size());
+		assert(stats.find_misses == data.size());
+		assert(stats.rehash_count > 0);
+		assert(stats.bytes_allocated > stats.bytes_freed);
+		assert(stats.free_tree_searches > 0);
+
+		h.reset_stats();
+		// the const find updates the stats too.
+		const fhash_table_t& const_h = h;
+		for (size_t i = 0; i < data.size(); i++)
+		{
+			assert(const_h.find(data[i]) != nullptr);
+		}
+		assert(stats.find_hits == data.size());
+		assert(stats.find_hit_chain_length >= data.size());
+		assert(stats.find_misses == 0);
+
+		for (size_t i = 0; i < data.size(); i++)
+		{
+			h.erase(data[i]);
+		}
+		assert(stats.removes == data.size());
+		assert(h.size() == 0);
+
+		using standalone_table_t = fhash_table<int64_t, int64_t, std::hash<int64_t>, standalone_allocator_policy>;
+		using standalone_policy_t = standalone_table_t::allocator_policy;
+		static_assert(standalone_policy_t::max_chain_length == 8 && !standalone_policy_t::bucket_filter
+			&& standalone_policy_t::growth_factor100 == fhash_default_allocator_policy::growth_factor100, "");
+		// the empty fhash_no_stats takes no space.
+		static_assert(sizeof(fhash_table<int64_t, int64_t>) + sizeof(fhash_runtime_stats) == sizeof(standalone_table_t), "");
+		standalone_table_t standalone;
+		for (size_t i = 0; i < data.size(); i++)
+		{
+			standalone.insert(data[i], int64_t(i));
+		}
+		standalone.validate();
+		assert(standalone.get_stats().inserts == data.size() && standalone.get_stats().rehash_count > 0);
+	}
+
+	// free tree rebalance test.
+	{
+		struct stats_allocator_policy : fhash_default_allocator_policy
+		{
+			using stats_t = fhash_runtime_stats;
+		};
+		using fhash_table_t = fhash_table<int64_t, int64_t, std::hash<int64_t>, stats_allocator_policy>;
+		const int64_t n = 100000;
+		fhash_table_t h;
+		h.reserve(typename fhash_table_t::fhash_size_t(n));
+		// fill all the entries, so the free tree is empty.
+		for (int64_t i = 0; h.size() < n || h.size() < h.capacity(); i++)
+		{
+			h.insert(i * 7919, i);
+		}
+		// freeing the entries in index order would degenerate the free tree into a list.
+		for (auto it = h.begin(); it < h.end(); it = h.erase(it));
+		assert(h.size() == 0);
+		h.validate();
+		h.reset_stats();
+		// the colliding keys search the free tree for the nearest free entry.
+		for (int64_t key : gen_random_data<true>(int32_t(n / 2)))
+		{
+			h.insert(key, key);
+		}
+		h.validate();
+		int64_t max_depth = 3;
+		for (int64_t tree_size = h.capacity(); tree_size > 1; tree_size >>= 1)
+		{
+			max_depth += 2;
+		}
+		assert(h.get_stats().free_tree_searches > 0 && int64_t(h.get_stats().max_free_tree_depth) <= max_depth);
+	}
+
+	// cache line tracer test.
+	{
+		struct tracer_allocator_policy : fhash_default_allocator_policy
+		{
+			using stats_t = fhash_cache_line_tracer;
+		};
+		using fhash_table_t = fhash_table<int64_t, int64_t, std::hash<int64_t>, tracer_allocator_policy>;
+		fhash_table_t h;
+		std::vector<int64_t> data = gen_random_data<true>(1000);
+		for (size_t i = 0; i < data.size(); i++)
+		{
+			h.insert(data[i], int64_t(i));
+		}
+		h.reset_stats();
+		for (size_t i = 0; i < data.size(); i++)
+		{
+			assert(h.find(data[i]) != nullptr);
+		}
+		const std::vector<uint64_t>& histogram = h.get_stats().histograms[size_t(fhash_operation::find)];
+		uint64_t finds = 0;
+		for (size_t i = 0; i < histogram.size(); i++)
+		{
+			finds += histogram[i];
+		}
+		assert(finds == data.size());
+		assert(histogram[0] == 0);
+		assert(h.get_stats().average_cache_lines(fhash_operation::find) >= 1.0);
+	}
+
+	// random test.
+	{
+		using fhash_table_t = fhash_table<int32_t, int32_t>;
+		fhash_table_t h;
+		for (uint32_t j = 0; j < 100; j++)
+		{
+			const uint32_t N = 1000;
+			for (uint32_t i = 0; i < N; i++)
+			{
+				h.insert(rand(), i);
+			}
+
+			uint32_t deleted = 0;
+			typename fhash_table_t::fhash_size_t total = h.size();
+			for (uint32_t k = 0; k < 10; k++)
+			{
+				for (auto it = h.begin(); it < h.end();)
+				{
+					if (rand() & 1)
+					{
+						it = h.erase(it);
+						deleted++;
+					}
+					else
+					{
+						it++;
+					}
+				}
+			}
+			assert(total == h.size() + deleted);
+		}
+	}
+}
+
+static void test_find_success()
+{
+	for (int32_t i = 1; i < 15; i++)
+	{
+		const int32_t N = int32_t(std::pow(3, i));
+		std::cout << "N = " << N << std::endl;
+		std::vector<int64_t> data = gen_random_data<true>(N);
+		{
+			fhash_table<int64_t, int64_t> m;
+			for (int64_t i : data)
+			{
+				m.insert(i, i);
+			}
+			std::vector<int64_t> shuffled_data = data;
+			std::random_shuffle(shuffled_data.begin(), shuffled_data.end());
+			auto start = std::chrono::high_resolution_clock::now();
+			int64_t sum = 0;
+			for (int32_t i = 0; i < 100000000 / N; i++)
+			{
+				for (int64_t i : shuffled_data)
+				{
+					sum += *m.find(i);
+				}
+			}
+			auto end = std::chrono::high_resolution_clock::now();
+			auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+			std::cout << "fhash_table, elapsed milliseconds: " << elapsed << " sum: " << sum << " load_factor: " << m.load_factor() << std::endl;
+		}
+		{
+			std::unordered_map<int64_t, int64_t> m;
+			for (int64_t i : data)
+			{
+				m.emplace(i, i);
+			}
+			std::vector<int64_t> shuffled_data = data;
+			std::random_shuffle(shuffled_data.begin(), shuffled_data.end());
+			int64_t sum = 0;
+			auto start = std::chrono::high_resolution_clock::now();
+			for (int32_t i = 0; i < 100000000 / N; i++)
+			{
+				for (int64_t i : shuffled_data)
+				{
+					sum += m.find(i)->second;
+				}
+			}
+			auto end = std::chrono::high_resolution_clock::now();
+			auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+			std::cout << "std::unordered_map, elapsed milliseconds: " << elapsed << " sum: " << sum << std::endl;
+		}
+	}
+}
+
+template <typename map_t>
+static void test_find_miss(const char* name, const std::vector<int64_t>& data, const std::vector<int64_t>& lookups)
+{
+	map_t m;
+	for (int64_t i : data)
+	{
+		m.insert(std::make_pair(i, i));
+	}
+	auto start = std::chrono::high_resolution_clock::now();
+	int64_t found = 0;
+	for (size_t i = 0; i < 100000000 / lookups.size(); i++)
+	{
+		for (int64_t i : lookups)
+		{
+			found += m.find(i) != m.end() ? 1 : 0;
+		}
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+	auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+	std::cout << name << ", elapsed milliseconds: " << elapsed << " found: " << found << std::endl;
+}
+
+// adapts fhash_table to the std::unordered_map interface used by test_find_miss.
+template <typename allocator_policy>
+struct find_miss_table : fhash_table<int64_t, int64_t, std::hash<int64_t>, allocator_policy>
+{
+	void insert(const std::pair<int64_t, int64_t>& item)
+	{
+		fhash_table<int64_t, int64_t, std::hash<int64_t>, allocator_policy>::insert(item.first, item.second);
+	}
+	const int64_t* end() const
+	{
+		return nullptr;
+	}
+};
+
+static void test_find_miss()
+{
+	// all misses, and a dedup check mix where 70% of the lookups miss.
+	for (int32_t i = 2; i < 15; i += 3)
+	{
+		const int32_t N = int32_t(std::pow(3, i));
+		std::cout << "N = " << N << std::endl;
+		std::vector<int64_t> data = gen_random_data<true>(N * 2);
+		std::vector<int64_t> misses(data.begin() + N, data.end());
+		data.resize(N);
+		std::vector<int64_t> mixed;
+		for (int32_t j = 0; j < N; j++)
+		{
+			mixed.push_back(j % 10 < 3 ? data[j] : misses[j]);
+		}
+		std::random_shuffle(mixed.begin(), mixed.end());
+		test_find_miss<find_miss_table<fhash_default_allocator_policy>>("fhash_table all misses", data, misses);
+		test_find_miss<find_miss_table<bucket_filter_allocator_policy>>("fhash_table bucket filter all misses", data, misses);
+		test_find_miss<std::unordered_map<int64_t, int64_t>>("std::unordered_map all misses", data, misses);
+		test_find_miss<find_miss_table<fhash_default_allocator_policy>>("fhash_table 70% misses", data, mixed);
+		test_find_miss<find_miss_table<bucket_filter_allocator_policy>>("fhash_table bucket filter 70% misses", data, mixed);
+		test_find_miss<std::unordered_map<int64_t, int64_t>>("std::unordered_map 70% misses", data, mixed);
+	}
+}
+
+static void test_effect_memory()
+{
+	struct tracer_allocator_policy : fhash_default_allocator_policy
+	{
+		using stats_t = fhash_cache_line_tracer;
+	};
+	for (int32_t i = 1; i < 14; i++)
+	{
+		const int32_t N = int32_t(std::pow(3, i));
+		std::vector<int64_t> data = gen_random_data<true>(N);
+		fhash_table<int64_t, int64_t, std::hash<int64_t>, tracer_allocator_policy> m;
+		for (int64_t i : data)
+		{
+			m.insert(i, i);
+		}
+		const double insert_bytes = m.get_stats().average_bytes(fhash_operation::insert);
+		const double free_tree_bytes = m.get_stats().average_bytes(fhash_operation::free_tree_walk);
+		m.reset_stats();
+		for (int64_t i : data)
+		{
+			m.find(i);
+		}
+		std::cout << "N = " << N << " fhash_table, find touched bytes: " << m.get_stats().average_bytes(fhash_operation::find)
+			<< " insert touched bytes: " << insert_bytes
+			<< " free tree walk touched bytes: " << free_tree_bytes << std::endl;
+	}
+}
+
+template <typename allocator_policy>
+static void test_cache_line_allocation(const char* name, const std::vector<int64_t>& data, const std::vector<int64_t>& shuffled_data)
+{
+	fhash_table<int64_t, int64_t, std::hash<int64_t>, allocator_policy> m;
+	for (int64_t i : data)
+	{
+		m.insert(i, i);
+	}
+	// churn, so the free slots are scattered.
+	for (size_t i = 0; i < data.size(); i += 2)
+	{
+		m.erase(data[i]);
+		m.insert(data[i], data[i]);
+	}
+	const auto cache_lines = m.get_chain_cache_line_stats();
+	int64_t chains = 0;
+	int64_t lines = 0;
+	for (size_t i = 0; i < cache_lines.size(); i++)
+	{
+		chains += cache_lines[i];
+		lines += int64_t(cache_lines[i]) * i;
+	}
+	auto start = std::chrono::high_resolution_clock::now();
+	int64_t sum = 0;
+	for (int64_t i : shuffled_data)
+	{
+		sum += *m.find(i);
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+	auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+	std::cout << name << ", cache lines per chain: " << double(lines) / chains
+		<< " single line chains: " << double(cache_lines.size() > 1 ? cache_lines[1] : 0) / chains
+		<< " find elapsed milliseconds: " << elapsed << " sum: " << sum << std::endl;
+}
+
+static void test_cache_line_allocation()
+{
+	for (int32_t N : {100000, 1000000, 10000000})
+	{
+		std::cout << "N = " << N << std::endl;
+		std::vector<int64_t> data = gen_random_data<false>(N);
+		std::vector<int64_t> shuffled_data = data;
+		std::random_shuffle(shuffled_data.begin(), shuffled_data.end());
+		test_cache_line_allocation<fhash_default_allocator_policy>("fhash_table nearest slot", data, shuffled_data);
+		test_cache_line_allocation<cache_line_aware_allocator_policy>("fhash_table cache line aware", data, shuffled_data);
+	}
+}
+
+template <typename allocator_policy>
+static void test_two_choice(const char* name, const std::vector<int64_t>& data, const std::vector<int64_t>& shuffled_data)
+{
+	fhash_table<int64_t, int64_t, std::hash<int64_t>, allocator_policy> m;
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int64_t i : data)
+	{
+		m.insert(i, i);
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+	auto insert_elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+	start = std::chrono::high_resolution_clock::now();
+	int64_t sum = 0;
+	for (int64_t i : shuffled_data)
+	{
+		sum += *m.find(i);
+	}
+	for (int64_t i : shuffled_data)
+	{
+		sum += m.find(i + 1) ? 1 : 0;
+	}
+	end = std::chrono::high_resolution_clock::now();
+	auto find_elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+	std::cout << name << ", max chain length: " << m.get_chain_length_stats().size() - 1
+		<< " insert elapsed milliseconds: " << insert_elapsed
+		<< " find hit and miss elapsed milliseconds: " << find_elapsed << " sum: " << sum << std::endl;
+}
+
+static void test_two_choice()
+{
+	for (int32_t N : {100000, 1000000, 10000000})
+	{
+		std::cout << "N = " << N << std::endl;
+		std::vector<int64_t> data = gen_random_data<false>(N);
+		std::vector<int64_t> shuffled_data = data;
+		std::random_shuffle(shuffled_data.begin(), shuffled_data.end());
+		test_two_choice<fhash_default_allocator_policy>("fhash_table random keys", data, shuffled_data);
+		test_two_choice<two_choice_allocator_policy>("fhash_table two choice random keys", data, shuffled_data);
+
+		// strided keys share their low bits, the identity hash puts them in a few buckets.
+		for (size_t i = 0; i < data.size(); i++)
+		{
+			data[i] = int64_t(i) << 12;
+		}
+		shuffled_data = data;
+		std::random_shuffle(shuffled_data.begin(), shuffled_data.end());
+		if (N <= 100000)
+		{
+			test_two_choice<fhash_default_allocator_policy>("fhash_table strided keys", data, shuffled_data);
+		}
+		test_two_choice<two_choice_allocator_policy>("fhash_table two choice strided keys", data, shuffled_data);
+	}
+}
+
+template <typename allocator_policy>
+static void test_fastrange_buckets(const char* name, const std::vector<int64_t>& data, const std::vector<int64_t>& shuffled_data, bool reserve)
+{
+	fhash_table<int64_t, int64_t, std::hash<int64_t>, allocator_policy> m;
+	if (reserve)
+	{
+		m.reserve(int32_t(data.size()));
+	}
+	for (int64_t i : data)
+	{
+		m.insert(i, i);
+	}
+	auto start = std::chrono::high_resolution_clock::now();
+	int64_t sum = 0;
+	for (int32_t i = 0; i < 10; i++)
+	{
+		for (int64_t i : shuffled_data)
+		{
+			sum += *m.find(i);
+		}
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+	auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+	std::cout << name << ", bytes per element: " << double(m.memory_usage()) / m.size() << " load_factor: " << m.load_factor()
+		<< " find elapsed milliseconds: " << elapsed << " sum: " << sum << std::endl;
+}
+
+static void test_fastrange_buckets()
+{
+	// the sizes just above and below the powers of 2 of the buckets.
+	for (int32_t N : {800000, 1600000, 3000000, 3300000, 6000000})
+	{
+		std::cout << "N = " << N << std::endl;
+		std::vector<int64_t> data = gen_random_data<true>(N);
+		std::vector<int64_t> shuffled_data = data;
+		std::random_shuffle(shuffled_data.begin(), shuffled_data.end());
+		test_fastrange_buckets<fhash_default_allocator_policy>("fhash_table power of 2 buckets", data, shuffled_data, false);
+		test_fastrange_buckets<fastrange_allocator_policy>("fhash_table fastrange buckets, 125% growth", data, shuffled_data, false);
+		test_fastrange_buckets<fhash_default_allocator_policy>("fhash_table power of 2 buckets, reserved", data, shuffled_data, true);
+		test_fastrange_buckets<fastrange_allocator_policy>("fhash_table fastrange buckets, reserved", data, shuffled_data, true);
+	}
+}
+
+static void test_load_parameters()
+{
+	// sweep the elements per bucket, pick the ratio from the find and insert speed against the memory.
+	const int32_t N = 1000000;
+	std::cout << "N = " << N << std::endl;
+	std::vector<int64_t> data = gen_random_data<true>(N);
+	std::vector<int64_t> shuffled_data = data;
+	std::random_shuffle(shuffled_data.begin(), shuffled_data.end());
+	for (int32_t elements_per_bucket100 : {100, 125, 150, 200, 300, 400})
+	{
+		fhash_table<int64_t, int64_t> m;
+		m.set_load_parameters(elements_per_bucket100);
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int64_t i : data)
+		{
+			m.insert(i, i);
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+		auto insert_elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+		start = std::chrono::high_resolution_clock::now();
+		int64_t sum = 0;
+		for (int32_t i = 0; i < 10; i++)
+		{
+			for (int64_t i : shuffled_data)
+			{
+				sum += *m.find(i);
+			}
+		}
+		end = std::chrono::high_resolution_clock::now();
+		auto find_elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+		std::cout << "elements_per_bucket100: " << elements_per_bucket100
+			<< ", insert M/s: " << N * 1e3 / insert_elapsed
+			<< " find M/s: " << N * 10 * 1e3 / find_elapsed
+			<< " bytes per element: " << double(m.memory_usage()) / m.size()
+			<< " load_factor: " << m.load_factor() << " sum: " << sum << std::endl;
+	}
+}
+
+// the usual LRU, a list in use order and a map to the list nodes.
+class list_lru_cache
+{
+public:
+	explicit list_lru_cache(size_t capacity)
+		: m_capacity(capacity)
+	{
+		m_map.reserve(capacity);
+	}
+
+	int64_t* find(int64_t key)
+	{
+		auto it = m_map.find(key);
+		if (it == m_map.end())
+		{
+			return nullptr;
+		}
+		m_list.splice(m_list.begin(), m_list, it->second);
+		return &it->second->second;
+	}
+
+	void insert(int64_t key, int64_t value)
+	{
+		if (m_map.size() >= m_capacity)
+		{
+			m_map.erase(m_list.back().first);
+			m_list.pop_back();
+		}
+		m_list.emplace_front(key, value);
+		m_map.emplace(key, m_list.begin());
+	}
+
+private:
+	size_t m_capacity;
+	std::list<std::pair<int64_t, int64_t>> m_list;
+	std::unordered_map<int64_t, std::list<std::pair<int64_t, int64_t>>::iterator> m_map;
+};
+
+template <typename cache_t>
+static void test_cache(const char* name, const std::vector<int64_t>& requests, size_t capacity)
+{
+	cache_t cache(capacity);
+	auto start = std::chrono::high_resolution_clock::now();
+	int64_t hits = 0;
+	for (int64_t key : requests)
+	{
+		if (int64_t* value = cache.find(key))
+		{
+			hits++;
+		}
+		else
+		{
+			cache.insert(key, key);
+		}
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+	auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+	std::cout << name << ", elapsed milliseconds: " << elapsed << " hit rate: " << double(hits) / requests.size() << std::endl;
+}
+
+static void test_cache()
+{
+	// skewed requests over 10x more keys than the capacity.
+	const int32_t capacity = 1000000;
+	const int32_t N = 20000000;
+	std::cout << "capacity = " << capacity << " requests = " << N << std::endl;
+	std::vector<int64_t> keys = gen_random_data<true>(capacity * 10);
+	std::vector<int64_t> requests(N);
+	for (int64_t& r : requests)
+	{
+		const double u = double(rand()) / RAND_MAX;
+		r = keys[size_t(u * u * u * (keys.size() - 1))];
+	}
+	test_cache<fhash_cache<int64_t, int64_t>>("fhash_cache", requests, capacity);
+	test_cache<list_lru_cache>("std::unordered_map + std::list", requests, capacity);
+}
+
+enum class key_distribution
+{
+	uniform,
+	zipfian,
+	sequential,
+	hot_set,
+};
+
+struct workload
+{
+	const char* name;
+	key_distribution distribution;
+	// the rest of the operations are finds.
+	int32_t insert_percent;
+	int32_t erase_percent;
+	// the percent of the finds looking up absent keys.
+	int32_t miss_percent;
+	int32_t table_size;
+	int32_t operations;
+};
+
+// picks positions in [0, n) with probability proportional to 1 / (rank + 1)^theta, see Gray et al., "Quickly Generating Billion-Record Synthetic Databases".
+class zipfian_generator
+{
+public:
+	zipfian_generator(int32_t n, double theta = 0.99)
+		: m_n(n)
+		, m_theta(theta)
+	{
+		m_zeta2 = zeta(2);
+		m_zetan = zeta(n);
+		m_alpha = 1.0 / (1.0 - theta);
+		m_eta = (1.0 - std::pow(2.0 / n, 1.0 - theta)) / (1.0 - m_zeta2 / m_zetan);
+	}
+
+	template <typename random_t>
+	int32_t operator()(random_t& random, int32_t n)
+	{
+		const double u = std::uniform_real_distribution<double>(0.0, 1.0)(random);
+		const double uz = u * m_zetan;
+		int32_t rank = 0;
+		if (uz < 1.0)
+		{
+			rank = 0;
+		}
+		else if (uz < 1.0 + std::pow(0.5, m_theta))
+		{
+			rank = 1;
+		}
+		else
+		{
+			rank = int32_t(m_n * std::pow(m_eta * u - m_eta + 1.0, m_alpha));
+		}
+		// the live keys change size with inserts and erases.
+		return rank % n;
+	}
+
+private:
+	double zeta(int32_t n) const
+	{
+		double sum = 0;
+		for (int32_t i = 1; i <= n; i++)
+		{
+			sum += 1.0 / std::pow(double(i), m_theta);
+		}
+		return sum;
+	}
+
+	int32_t m_n;
+	double m_theta;
+	double m_zeta2;
+	double m_zetan;
+	double m_alpha;
+	double m_eta;
+};
+
+enum class operation_type : uint8_t
+{
+	find,
+	insert,
+	erase,
+};
+
+struct operation
+{
+	operation_type type;
+	int64_t key;
+};
+
+// the live keys are odd, the missing keys are even. the same operations are replayed on every table.
+static std::vector<operation> gen_workload(const workload& w, std::vector<int64_t>& initial_keys)
+{
+	std::mt19937_64 random(12345);
+	auto next_key = [&random]() {return int64_t(random() | 1); };
+	std::vector<int64_t> keys(w.table_size);
+	for (int64_t& key : keys)
+	{
+		key = next_key();
+	}
+	initial_keys = keys;
+	zipfian_generator zipfian(w.table_size);
+	int32_t sequential = 0;
+	auto pick = [&]() -> size_t {
+		const int32_t n = int32_t(keys.size());
+		switch (w.distribution)
+		{
+		case key_distribution::zipfian:
+			return size_t(zipfian(random, n));
+		case key_distribution::sequential:
+			return size_t(sequential++ % n);
+		case key_distribution::hot_set:
+			// 90% of the operations on 10% of the keys.
+			if (random() % 10 != 0)
+			{
+				return size_t(random() % std::max(n / 10, 1));
+			}
+			return size_t(random() % n);
+		default:
+			return size_t(random() % n);
+		}
+	};
+	std::vector<operation> operations(w.operations);
+	for (operation& op : operations)
+	{
+		const int32_t r = int32_t(random() % 100);
+		if (r < w.insert_percent)
+		{
+			op.type = operation_type::insert;
+			op.key = next_key();
+			keys.push_back(op.key);
+		}
+		else if (r < w.insert_percent + w.erase_percent && !keys.empty())
+		{
+			op.type = operation_type::erase;
+			const size_t i = pick();
+			op.key = keys[i];
+			keys[i] = keys.back();
+			keys.pop_back();
+		}
+		else
+		{
+			op.type = operation_type::find;
+			op.key = int32_t(random() % 100) < w.miss_percent || keys.empty() ? int64_t(random() & ~1ull) : keys[pick()];
+		}
+	}
+	return operations;
+}
+
+struct fhash_table_adapter
+{
+	fhash_table<int64_t, int64_t> m;
+	bool find(int64_t key) const { return m.find(key) != nullptr; }
+	void insert(int64_t key) { m.insert(key, key); }
+	void erase(int64_t key) { m.erase(key); }
+};
+
+struct unordered_map_adapter
+{
+	std::unordered_map<int64_t, int64_t> m;
+	bool find(int64_t key) const { return m.find(key) != m.end(); }
+	void insert(int64_t key) { m.emplace(key, key); }
+	void erase(int64_t key) { m.erase(key); }
+};
+
+template <typename adapter_t>
+static int64_t run_operation(adapter_t& adapter, const operation& op)
+{
+	switch (op.type)
+	{
+	case operation_type::insert:
+		adapter.insert(op.key);
+		return 0;
+	case operation_type::erase:
+		adapter.erase(op.key);
+		return 0;
+	default:
+		return adapter.find(op.key);
+	}
+}
+
+template <typename adapter_t>
+static void test_workload(const char* name, const std::vector<int64_t>& initial_keys, const std::vector<operation>& operations)
+{
+	// the first pass measures the throughput, the second one the latency of every operation.
+	int64_t hits = 0;
+	int64_t elapsed = 0;
+	std::vector<int64_t> latencies;
+	latencies.reserve(operations.size());
+	for (int32_t pass = 0; pass < 2; pass++)
+	{
+		adapter_t adapter;
+		for (int64_t key : initial_keys)
+		{
+			adapter.insert(key);
+		}
+		hits = 0;
+		if (pass == 0)
+		{
+			auto start = std::chrono::steady_clock::now();
+			for (const operation& op : operations)
+			{
+				hits += run_operation(adapter, op);
+			}
+			auto end = std::chrono::steady_clock::now();
+			elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+		}
+		else
+		{
+			for (const operation& op : operations)
+			{
+				auto start = std::chrono::steady_clock::now();
+				hits += run_operation(adapter, op);
+				auto end = std::chrono::steady_clock::now();
+				latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+			}
+		}
+	}
+	std::sort(latencies.begin(), latencies.end());
+	auto percentile = [&latencies](double p) {return latencies[size_t(p * (latencies.size() - 1))]; };
+	std::cout << name << ", M ops/s: " << operations.size() * 1e3 / elapsed
+		<< " latency nanoseconds p50: " << percentile(0.5) << " p99: " << percentile(0.99)
+		<< " p99.9: " << percentile(0.999) << " max: " << latencies.back() << " hits: " << hits << std::endl;
+}
+
+static void test_workloads()
+{
+	const int32_t table_size = 1000000;
+	const int32_t operations = 5000000;
+	const workload workloads[] = {
+		{"read mostly, uniform", key_distribution::uniform, 2, 2, 10, table_size, operations},
+		{"read mostly, zipfian", key_distribution::zipfian, 2, 2, 10, table_size, operations},
+		{"read mostly, hot set", key_distribution::hot_set, 2, 2, 10, table_size, operations},
+		{"read mostly, sequential", key_distribution::sequential, 2, 2, 10, table_size, operations},
+		{"churn, zipfian", key_distribution::zipfian, 25, 25, 10, table_size, operations},
+		{"misses, uniform", key_distribution::uniform, 0, 0, 90, table_size, operations},
+	};
+	for (const workload& w : workloads)
+	{
+		std::cout << w.name << ": table size = " << w.table_size << " operations = " << w.operations
+			<< " insert% = " << w.insert_percent << " erase% = " << w.erase_percent << " miss% = " << w.miss_percent << std::endl;
+		std::vector<int64_t> initial_keys;
+		const std::vector<operation> ops = gen_workload(w, initial_keys);
+		test_workload<fhash_table_adapter>("fhash_table", initial_keys, ops);
+		test_workload<unordered_map_adapter>("std::unordered_map", initial_keys, ops);
+	}
+}
+
+template <int32_t period>
+struct self_organizing_period_allocator_policy : fhash_default_allocator_policy
+{
+	static constexpr int32_t self_organizing_period = period;
+};
+
+template <int32_t period>
+static void test_self_organizing(const char* name, const std::vector<int64_t>& data, const std::vector<int64_t>& lookups,
+	int32_t elements_per_bucket100)
+{
+	fhash_table<int64_t, int64_t, std::hash<int64_t>, self_organizing_period_allocator_policy<period>> m;
+	m.set_load_parameters(elements_per_bucket100);
+	for (int64_t i : data)
+	{
+		m.insert(i, i);
+	}
+	auto start = std::chrono::high_resolution_clock::now();
+	int64_t sum = 0;
+	for (int64_t i : lookups)
+	{
+		sum += *m.find(i);
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+	auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+	std::cout << name << ", elapsed milliseconds: " << elapsed << " sum: " << sum << std::endl;
+}
+
+static void test_self_organizing()
+{
+	// zipfian finds, the hot keys are spread over the table.
+	const int32_t lookup_count = 20000000;
+	std::mt19937_64 random(1);
+	for (int32_t N : {100000, 1000000, 10000000})
+	{
+		const std::vector<int64_t> data = gen_random_data<true>(N);
+		zipfian_generator zipfian(N);
+		std::vector<int64_t> lookups(lookup_count);
+		for (int64_t& key : lookups)
+		{
+			key = data[zipfian(random, N)];
+		}
+		for (int32_t elements_per_bucket100 : {150, 400})
+		{
+			std::cout << "N = " << N << " elements_per_bucket100: " << elements_per_bucket100 << std::endl;
+			test_self_organizing<0>("fhash_table", data, lookups, elements_per_bucket100);
+			test_self_organizing<1>("fhash_table self organizing every hit", data, lookups, elements_per_bucket100);
+			test_self_organizing<16>("fhash_table self organizing every 16 hits", data, lookups, elements_per_bucket100);
+		}
+	}
+}
+
+static void test_erase_if()
+{
+	const int32_t N = 4000000;
+	std::cout << "N = " << N << std::endl;
+	std::vector<int64_t> data = gen_random_data<true>(N);
+	fhash_table<int64_t, int64_t> m;
+	for (int64_t i : data)
+	{
+		m.insert(i, i);
+	}
+	fhash_table<int64_t, int64_t> m2 = m;
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		int32_t erased = 0;
+		for (auto it = m.begin(); it != m.end();)
+		{
+			if (it.value() % 10 < 3)
+			{
+				it = m.erase(it);
+				erased++;
+			}
+			else
+			{
+				++it;
+			}
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+		auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+		std::cout << "fhash_table erase one by one, elapsed milliseconds: " << elapsed << " erased: " << erased << std::endl;
+	}
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		int32_t erased = m2.erase_if([](int64_t, int64_t value) {return value % 10 < 3; });
+		auto end = std::chrono::high_resolution_clock::now();
+		auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+		std::cout << "fhash_table erase_if, elapsed milliseconds: " << elapsed << " erased: " << erased << std::endl;
+	}
+}
+
+static void test_free_tree()
+{
+	const int32_t N = 50000;
+	std::cout << "N = " << N << std::endl;
+	std::vector<int64_t> data = gen_random_data<true>(N);
+	fhash_table<int64_t, int64_t> m;
+	m.reserve(N);
+	// fill all the entries, so every erased entry goes back to the free tree.
+	for (int64_t i = 0; m.size() < N || m.size() < m.capacity(); i++)
+	{
+		m.insert(i * 7919, i);
+	}
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		int32_t erased = 0;
+		for (auto it = m.begin(); it != m.end(); it = m.erase(it))
+		{
+			erased++;
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+		auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+		std::cout << "fhash_table erase in index order, elapsed milliseconds: " << elapsed << " erased: " << erased << std::endl;
+	}
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int64_t i : data)
+		{
+			m.insert(i, i);
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+		auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+		std::cout << "fhash_table insert after erase in index order, elapsed milliseconds: " << elapsed << " size: " << m.size() << std::endl;
+	}
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int64_t i : data)
+		{
+			m.erase(i);
+			m.insert(i + 1, i);
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+		auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+		std::cout << "fhash_table random erase and insert, elapsed milliseconds: " << elapsed << " size: " << m.size() << std::endl;
+	}
+}
+
+static void test_insert_bulk()
+{
+	const int32_t N = 4000000;
+	std::cout << "N = " << N << std::endl;
+	std::vector<int64_t> data = gen_random_data<true>(N);
+	std::vector<std::pair<int64_t, int64_t>> items;
+	items.reserve(N);
+	for (int64_t i : data)
+	{
+		items.emplace_back(i, i);
+	}
+	{
+		fhash_table<int64_t, int64_t> m;
+		auto start = std::chrono::high_resolution_clock::now();
+		m.reserve(int32_t(items.size()));
+		for (auto& item : items)
+		{
+			m.insert(item.first, item.second);
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+		auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+		std::cout << "fhash_table reserve and insert one by one, elapsed milliseconds: " << elapsed << std::endl;
+	}
+	{
+		fhash_table<int64_t, int64_t> m;
+		auto start = std::chrono::high_resolution_clock::now();
+		m.insert_bulk(items.data(), int32_t(items.size()));
+		auto end = std::chrono::high_resolution_clock::now();
+		auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+		std::cout << "fhash_table insert_bulk, elapsed milliseconds: " << elapsed << std::endl;
+	}
+
+	// half of the keys exist already.
+	fhash_table<int64_t, int64_t> populated;
+	populated.insert_bulk(items.data(), int32_t(items.size() / 2));
+	std::vector<std::pair<int64_t, int64_t>> mixed_items(items.begin() + items.size() / 4, items.begin() + items.size() * 3 / 4);
+	{
+		fhash_table<int64_t, int64_t> m = populated;
+		auto start = std::chrono::high_resolution_clock::now();
+		for (auto& item : mixed_items)
+		{
+			m.insert(item.first, item.second);
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+		auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+		std::cout << "fhash_table half existing insert one by one, elapsed milliseconds: " << elapsed << std::endl;
+	}
+	{
+		fhash_table<int64_t, int64_t> m = populated;
+		auto start = std::chrono::high_resolution_clock::now();
+		m.insert_bulk(mixed_items.data(), int32_t(mixed_items.size()));
+		auto end = std::chrono::high_resolution_clock::now();
+		auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+		std::cout << "fhash_table half existing insert_bulk, elapsed milliseconds: " << elapsed << std::endl;
+	}
+}
+
+static void test_group_by()
+{
+	// sum the values grouped by key, the groups range from cache resident to far larger than the cache.
+	const int32_t N = 10000000;
+	std::mt19937_64 random_engine(1);
+	std::vector<int64_t> values(N);
+	for (int32_t i = 0; i < N; i++)
+	{
+		values[i] = i & 0xff;
+	}
+	for (int32_t cardinality : {1000, 100000, 1000000, 10000000})
+	{
+		std::cout << "N = " << N << " groups = " << cardinality << std::endl;
+		const std::vector<int64_t> groups = gen_random_data<true>(cardinality);
+		std::vector<int64_t> keys(N);
+		for (int32_t i = 0; i < N; i++)
+		{
+			keys[i] = groups[random_engine() % groups.size()];
+		}
+		int64_t expected = 0;
+		{
+			fhash_table<int64_t, int64_t> m;
+			auto start = std::chrono::high_resolution_clock::now();
+			for (int32_t i = 0; i < N; i++)
+			{
+				int64_t* value = m.find(keys[i]);
+				if (value)
+				{
+					*value += values[i];
+				}
+				else
+				{
+					m.insert(keys[i], values[i]);
+				}
+			}
+			auto end = std::chrono::high_resolution_clock::now();
+			auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+			expected = *m.find(keys[0]);
+			std::cout << "fhash_table find and insert, elapsed milliseconds: " << elapsed << " groups: " << m.size() << std::endl;
+		}
+		{
+			fhash_table<int64_t, int64_t> m;
+			auto start = std::chrono::high_resolution_clock::now();
+			m.upsert_batch(keys.data(), values.data(), N, [](int64_t& value, const int64_t& new_value) {value += new_value; });
+			auto end = std::chrono::high_resolution_clock::now();
+			auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+			assert(*m.find(keys[0]) == expected);
+			std::cout << "fhash_table upsert_batch, elapsed milliseconds: " << elapsed << " groups: " << m.size() << std::endl;
+		}
+		{
+			std::unordered_map<int64_t, int64_t> m;
+			auto start = std::chrono::high_resolution_clock::now();
+			for (int32_t i = 0; i < N; i++)
+			{
+				m[keys[i]] += values[i];
+			}
+			auto end = std::chrono::high_resolution_clock::now();
+			auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+			assert(m[keys[0]] == expected);
+			std::cout << "unordered_map operator[], elapsed milliseconds: " << elapsed << " groups: " << m.size() << std::endl;
+		}
+	}
+}
+
+template <typename map_t>
+static void test_quotient_keys(const char* name, const std::vector<int64_t>& data, const std::vector<int64_t>& shuffled_data)
+{
+	map_t m;
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int64_t i : data)
+	{
+		m.insert(i, typename std::remove_pointer<decltype(m.find(i))>::type(i));
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+	auto insert_elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+	start = std::chrono::high_resolution_clock::now();
+	int64_t sum = 0;
+	for (int64_t i : shuffled_data)
+	{
+		sum += *m.find(i);
+	}
+	end = std::chrono::high_resolution_clock::now();
+	auto find_elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+	std::cout << name << ", bytes per element: " << double(m.memory_usage()) / m.size()
+		<< " insert elapsed milliseconds: " << insert_elapsed
+		<< " find elapsed milliseconds: " << find_elapsed << " sum: " << sum << std::endl;
+}
+
+static void test_quotient_keys()
+{
+	// 40 bit ids.
+	for (int32_t N : {1000000, 10000000})
+	{
+		std::cout << "N = " << N << std::endl;
+		std::mt19937_64 random(N);
+		std::vector<int64_t> data(N);
+		for (int64_t& i : data)
+		{
+			i = int64_t(random() >> 24);
+		}
+		std::vector<int64_t> shuffled_data = data;
+		std::random_shuffle(shuffled_data.begin(), shuffled_data.end());
+		test_quotient_keys<fhash_table<int64_t, int32_t>>("fhash_table<int64_t, int32_t>", data, shuffled_data);
+		test_quotient_keys<fhash_quotient_table<int64_t, int32_t, 40>>("fhash_quotient_table<int64_t, int32_t, 40>", data, shuffled_data);
+		test_quotient_keys<fhash_table<int64_t, int64_t>>("fhash_table<int64_t, int64_t>", data, shuffled_data);
+		test_quotient_keys<fhash_quotient_table<int64_t, int64_t, 40>>("fhash_quotient_table<int64_t, int64_t, 40>", data, shuffled_data);
+	}
+}
+
+static void test_merge()
+{
+	const int32_t N = 1000000;
+	const int32_t tables = 8;
+	std::cout << "N = " << N << " tables = " << tables << std::endl;
+	std::vector<int64_t> data = gen_random_data<true>(N * tables);
+	std::vector<fhash_table<int64_t, int64_t>> partials(tables);
+	for (size_t i = 0; i < data.size(); i++)
+	{
+		partials[i % tables].insert(data[i], data[i]);
+	}
+	{
+		fhash_table<int64_t, int64_t> m;
+		auto start = std::chrono::high_resolution_clock::now();
+		for (auto& partial : partials)
+		{
+			for (auto&& pr : partial)
+			{
+				m.insert(pr.first, pr.second);
+			}
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+		auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+		std::cout << "fhash_table insert one by one, elapsed milliseconds: " << elapsed << " size: " << m.size() << std::endl;
+	}
+	{
+		fhash_table<int64_t, int64_t> m;
+		auto start = std::chrono::high_resolution_clock::now();
+		for (auto& partial : partials)
+		{
+			m.merge(std::move(partial));
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+		auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+		std::cout << "fhash_table merge, elapsed milliseconds: " << elapsed << " size: " << m.size() << std::endl;
+	}
+}
+
+struct non_trivial_int64
+{
+	non_trivial_int64(int64_t v) : value(v) {}
+	non_trivial_int64(const non_trivial_int64& other) : value(other.value) {}
+	int64_t value;
+};
+
+template <typename value_t>
+static void test_copy(const char* name, const std::vector<int64_t>& data)
+{
+	fhash_table<int64_t, value_t> m;
+	for (int64_t i : data)
+	{
+		m.insert(i, value_t(i));
+	}
+	auto start = std::chrono::high_resolution_clock::now();
+	int64_t sum = 0;
+	for (int32_t i = 0; i < 20; i++)
+	{
+		fhash_table<int64_t, value_t> copy = m;
+		sum += copy.size();
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+	auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+	std::cout << name << ", copy 20 times, elapsed milliseconds: " << elapsed << " sum: " << sum << std::endl;
+}
+
+static void test_copy()
+{
+	const int32_t N = 1000000;
+	std::cout << "N = " << N << std::endl;
+	std::vector<int64_t> data = gen_random_data<true>(N);
+	test_copy<int64_t>("fhash_table<int64_t, int64_t>", data);
+	test_copy<non_trivial_int64>("fhash_table<int64_t, non_trivial_int64>", data);
+}
+
+struct snapshot_allocator_policy : fhash_default_allocator_policy
+{
+	static constexpr int32_t cow_page_entries = 4096;
+};
+
+static void test_snapshot()
+{
+	// take a snapshot, then write a few keys so only their pages get copied.
+	const int32_t N = 1000000;
+	const int32_t writes = 100;
+	std::cout << "N = " << N << " writes per snapshot = " << writes << std::endl;
+	std::vector<int64_t> data = gen_random_data<true>(N);
+	fhash_table<int64_t, int64_t> flat;
+	fhash_table<int64_t, int64_t, std::hash<int64_t>, snapshot_allocator_policy> paged;
+	for (int64_t i : data)
+	{
+		flat.insert(i, i);
+		paged.insert(i, i);
+	}
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		int64_t sum = 0;
+		for (int32_t i = 0; i < 20; i++)
+		{
+			fhash_table<int64_t, int64_t> copy = flat;
+			for (int32_t j = 0; j < writes; j++)
+			{
+				*copy.find(data[j * 7919 % N]) += 1;
+			}
+			sum += copy.size();
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+		auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+		std::cout << "fhash_table copy 20 times, elapsed milliseconds: " << elapsed << " sum: " << sum << std::endl;
+	}
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		int64_t sum = 0;
+		for (int32_t i = 0; i < 20; i++)
+		{
+			auto copy = paged.snapshot();
+			for (int32_t j = 0; j < writes; j++)
+			{
+				*copy.find(data[j * 7919 % N]) += 1;
+			}
+			sum += copy.size();
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+		auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+		std::cout << "fhash_table paged snapshot 20 times, elapsed milliseconds: " << elapsed << " sum: " << sum << std::endl;
+	}
+}
+
+// counts the data TLB misses of this thread, reads -1 if perf events are unavailable.
+struct tlb_miss_counter
+{
+	tlb_miss_counter()
+	{
+#if defined(__linux__)
+		perf_event_attr attr = {};
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HW_CACHE;
+		attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+	}
+
+	~tlb_miss_counter()
+	{
+#if defined(__linux__)
+		if (fd >= 0)
+		{
+			close(fd);
+		}
+#endif
+	}
+
+	void start()
+	{
+#if defined(__linux__)
+		if (fd >= 0)
+		{
+			ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+			ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+		}
+#endif
+	}
+
+	int64_t stop()
+	{
+		int64_t count = -1;
+#if defined(__linux__)
+		if (fd >= 0)
+		{
+			ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+			if (read(fd, &count, sizeof(count)) != sizeof(count))
+			{
+				count = -1;
+			}
+		}
+#endif
+		return count;
+	}
+
+	int fd = -1;
+};
+
+template <typename allocator_policy>
+static void test_find_huge_pages(const char* name, const std::vector<int64_t>& data, const std::vector<int64_t>& shuffled_data)
+{
+	fhash_table<int64_t, int64_t, std::hash<int64_t>, allocator_policy> m;
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int64_t i : data)
+	{
+		m.insert(i, i);
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+	auto insert_elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+	tlb_miss_counter counter;
+	counter.start();
+	start = std::chrono::high_resolution_clock::now();
+	int64_t sum = 0;
+	for (int64_t i : shuffled_data)
+	{
+		sum += *m.find(i);
+	}
+	end = std::chrono::high_resolution_clock::now();
+	const int64_t tlb_misses = counter.stop();
+	auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+	std::cout << name << ", insert elapsed milliseconds: " << insert_elapsed
+		<< " find nanoseconds per key: " << double(elapsed) / shuffled_data.size()
+		<< " dTLB misses per key: ";
+	if (tlb_misses >= 0)
+	{
+		std::cout << double(tlb_misses) / shuffled_data.size();
+	}
+	else
+	{
+		std::cout << "n/a";
+	}
+	std::cout << " sum: " << sum << std::endl;
+}
+
+static void test_find_huge_pages()
+{
+	// set FHASH_BENCH_LARGE to also run 100M entries, it needs several GB of memory.
+	std::vector<int32_t> sizes = {1000000, 10000000};
+	if (getenv("FHASH_BENCH_LARGE") != nullptr)
+	{
+		sizes.push_back(100000000);
+	}
+	for (int32_t N : sizes)
+	{
+		std::cout << "N = " << N << std::endl;
+		std::vector<int64_t> data = gen_random_data<false>(N);
+		std::vector<int64_t> shuffled_data = data;
+		std::random_shuffle(shuffled_data.begin(), shuffled_data.end());
+		test_find_huge_pages<fhash_default_allocator_policy>("fhash_table malloc", data, shuffled_data);
+		test_find_huge_pages<huge_page_allocator_policy>("fhash_table huge pages", data, shuffled_data);
+	}
+}
+
+static void test_segmented_table()
+{
+	const int32_t N = 10000000;
+	std::cout << "N = " << N << std::endl;
+	std::vector<int64_t> data = gen_random_data<false>(N);
+	std::vector<int64_t> shuffled_data = data;
+	std::random_shuffle(shuffled_data.begin(), shuffled_data.end());
+	{
+		fhash_table<int64_t, int64_t> m;
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int64_t i : data)
+		{
+			m.insert(i, i);
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+		auto insert_elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+		start = std::chrono::high_resolution_clock::now();
+		int64_t sum = 0;
+		for (int64_t i : shuffled_data)
+		{
+			sum += *m.find(i);
+		}
+		end = std::chrono::high_resolution_clock::now();
+		auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+		std::cout << "fhash_table, insert elapsed milliseconds: " << insert_elapsed << " find elapsed milliseconds: " << elapsed << " sum: " << sum << std::endl;
+	}
+	{
+		fhash_segmented_table<int64_t, int64_t> m;
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int64_t i : data)
+		{
+			m.insert(i, i);
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+		auto insert_elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+		start = std::chrono::high_resolution_clock::now();
+		int64_t sum = 0;
+		for (int64_t i : shuffled_data)
+		{
+			sum += *m.find(i);
+		}
+		end = std::chrono::high_resolution_clock::now();
+		auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+		std::cout << "fhash_segmented_table, insert elapsed milliseconds: " << insert_elapsed << " find elapsed milliseconds: " << elapsed << " sum: " << sum << std::endl;
+	}
+}
+
+template <typename table_t, typename insert_t>
+static void test_insert_latency(const char* name, const std::vector<int64_t>& data, bool reserved, insert_t insert)
+{
+	table_t m;
+	if (reserved)
+	{
+		m.reserve(data.size());
+	}
+	std::vector<int64_t> latencies;
+	latencies.reserve(data.size());
+	for (int64_t i : data)
+	{
+		auto start = std::chrono::steady_clock::now();
+		insert(m, i);
+		auto end = std::chrono::steady_clock::now();
+		latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+	}
+	std::sort(latencies.begin(), latencies.end());
+	auto percentile = [&latencies](double p) {return latencies[size_t(p * (latencies.size() - 1))]; };
+	std::cout << name << (reserved ? " reserved" : " growing") << ", insert nanoseconds p50: " << percentile(0.5)
+		<< " p99: " << percentile(0.99) << " p99.9: " << percentile(0.999) << " max: " << latencies.back() << std::endl;
+}
+
+static void test_insert_latency()
+{
+	const int32_t N = 1000000;
+	std::cout << "N = " << N << std::endl;
+	std::vector<int64_t> data = gen_random_data<true>(N);
+	using fhash_table_t = fhash_table<int64_t, int64_t>;
+	using unordered_map_t = std::unordered_map<int64_t, int64_t>;
+	// the max of the growing tables is the rehash, reserve up front to bound every insert.
+	for (bool reserved : {false, true})
+	{
+		test_insert_latency<fhash_table_t>("fhash_table", data, reserved, [](fhash_table_t& m, int64_t i) {m.insert(i, i); });
+		test_insert_latency<unordered_map_t>("std::unordered_map", data, reserved, [](unordered_map_t& m, int64_t i) {m.emplace(i, i); });
+	}
+}
+
+struct payload
+{
+	int64_t values[8];
+};
+
+static void test_iterate_dense_map()
+{
+	const int32_t N = 1000000;
+	std::cout << "N = " << N << std::endl;
+	std::vector<int64_t> data = gen_random_data<true>(N);
+	fhash_table<int64_t, payload> sparse;
+	fhash_dense_map<int64_t, payload> dense;
+	for (int64_t i : data)
+	{
+		sparse.insert(i, payload{ {i} });
+		dense.insert(i, payload{ {i} });
+	}
+	// erase a third so the sparse table has holes, as it would after churn.
+	for (size_t i = 0; i < data.size(); i += 3)
+	{
+		sparse.erase(data[i]);
+		dense.erase(data[i]);
+	}
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		int64_t sum = 0;
+		for (int32_t i = 0; i < 20; i++)
+		{
+			for (auto it = sparse.begin(); it; ++it)
+			{
+				sum += it.value().values[0];
+			}
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+		auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+		std::cout << "fhash_table iterate 20 times, elapsed milliseconds: " << elapsed << " sum: " << sum << std::endl;
+	}
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		int64_t sum = 0;
+		for (int32_t i = 0; i < 20; i++)
+		{
+			for (auto& pr : dense)
+			{
+				sum += pr.second.values[0];
+			}
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+		auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+		std::cout << "fhash_dense_map iterate 20 times, elapsed milliseconds: " << elapsed << " sum: " << sum << std::endl;
+	}
+	std::vector<int64_t> shuffled_data = data;
+	std::random_shuffle(shuffled_data.begin(), shuffled_data.end());
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		int64_t sum = 0;
+		for (int64_t i : shuffled_data)
+		{
+			const payload* p = sparse.find(i);
+			sum += p ? p->values[0] : 0;
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+		auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+		std::cout << "fhash_table find, elapsed milliseconds: " << elapsed << " sum: " << sum << std::endl;
+	}
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		int64_t sum = 0;
+		for (int64_t i : shuffled_data)
+		{
+			const payload* p = dense.find(i);
+			sum += p ? p->values[0] : 0;
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+		auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+		std::cout << "fhash_dense_map find, elapsed milliseconds: " << elapsed << " sum: " << sum << std::endl;
+	}
+}
+
+static void test_find_success_cache_miss_one()
+{
+	// lots of tables larger than L3 cache, find one key in every table.
+	const int32_t N = 1000;
+	const int32_t tables = 8192;
+	std::cout << "N = " << N << " tables = " << tables << std::endl;
+	using fhash_table_t = fhash_table<int64_t, int64_t>;
+	std::vector<int64_t> data = gen_random_data<true>(N);
+	std::vector<fhash_table_t> m(tables);
+	for (fhash_table_t& t : m)
+	{
+		for (int64_t i : data)
+		{
+			t.insert(i, i);
+		}
+	}
+	std::vector<int64_t> shuffled_data = data;
+	std::random_shuffle(shuffled_data.begin(), shuffled_data.end());
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		int64_t sum = 0;
+		for (int64_t i : shuffled_data)
+		{
+			for (const fhash_table_t& t : m)
+			{
+				sum += *t.find(i);
+			}
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+		auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+		std::cout << "fhash_table find, elapsed milliseconds: " << elapsed << " sum: " << sum << std::endl;
+	}
+	{
+		const int32_t prefetch_distance = 8;
+		auto start = std::chrono::high_resolution_clock::now();
+		int64_t sum = 0;
+		for (int64_t i : shuffled_data)
+		{
+			const fhash_table_t::precomputed_hash_t hash = m[0].hash_of(i);
+			for (int32_t t = 0; t < prefetch_distance; t++)
+			{
+				m[t].prefetch(hash);
+			}
+			for (int32_t t = 0; t < tables; t++)
+			{
+				if (t + prefetch_distance < tables)
+				{
+					m[t + prefetch_distance].prefetch(hash);
+				}
+				sum += *m[t].find(i, hash);
+			}
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+		auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+		std::cout << "fhash_table hash once and prefetch, elapsed milliseconds: " << elapsed << " sum: " << sum << std::endl;
+	}
+}
+
+static void test_parallel_for_each()
+{
+	const int32_t N = 10000000;
+	std::cout << "N = " << N << std::endl;
+	std::vector<int64_t> data = gen_random_data<true>(N);
+	fhash_table<int64_t, int64_t> m;
+	m.reserve(N);
+	for (int64_t i : data)
+	{
+		m.insert(i, i);
+	}
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		for (auto&& pr : m)
+		{
+			pr.second++;
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+		auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+		std::cout << "fhash_table for each, elapsed milliseconds: " << elapsed << std::endl;
+	}
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		m.parallel_for_each([](int64_t, int64_t& value) {value++; });
+		auto end = std::chrono::high_resolution_clock::now();
+		auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+		std::cout << "fhash_table parallel_for_each with " << std::thread::hardware_concurrency() << " threads, elapsed milliseconds: " << elapsed << std::endl;
 	}
 }
 
 static void perf_test()
 {
 	test_find_success();
+	test_find_miss();
+	test_workloads();
+	test_self_organizing();
+	test_effect_memory();
+	test_cache_line_allocation();
+	test_load_parameters();
+	test_fastrange_buckets();
+	test_two_choice();
+	test_erase_if();
+	test_free_tree();
+	test_insert_bulk();
+	test_group_by();
+	test_quotient_keys();
+	test_insert_latency();
+	test_merge();
+	test_copy();
+	test_snapshot();
+	test_find_success_cache_miss_one();
+	test_find_huge_pages();
+	test_segmented_table();
+	test_iterate_dense_map();
+	test_cache();
+	test_parallel_for_each();
 }
 
 int main()